@@ -0,0 +1,131 @@
+#ifndef CONTOURPP_AGGREGATE_H__
+#define CONTOURPP_AGGREGATE_H__
+
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include "contourpp_driver.hpp"
+#include "contourpp_record_table.hpp"
+
+namespace contourpp
+{
+
+// Count, mean, min, max and time in range of glucose values.
+struct glucose_stats
+{
+  boost::uint64_t count, sum, in_range;
+  unsigned short min, max;
+
+  glucose_stats() : count(0), sum(0), in_range(0), min(0xFFFF), max(0) {}
+
+  void add(unsigned short value, bool is_in_range) {
+    ++count;
+    sum += value;
+    in_range += is_in_range;
+    if (value < min) min = value;
+    if (value > max) max = value;
+  }
+
+  void merge(const glucose_stats& o) {
+    count += o.count;
+    sum += o.sum;
+    in_range += o.in_range;
+    if (o.min < min) min = o.min;
+    if (o.max > max) max = o.max;
+  }
+};
+
+// Counts of glucose values, for exact quantiles in O(n). The meter reports
+// values up to 600 (601 stands for "high"), so every value has its own bin;
+// larger values (which only an edited dump can have) are counted apart.
+class glucose_histogram
+{
+public:
+  static const size_t bins = 602;
+
+private:
+  std::vector<boost::uint32_t> counts_;
+  std::map<unsigned short, boost::uint64_t> overflow_;
+  boost::uint64_t count_;
+
+public:
+  glucose_histogram() : counts_(bins), count_(0) {}
+
+  void add(unsigned short value) {
+    if (value < bins)
+      ++counts_[value];
+    else
+      ++overflow_[value];
+    ++count_;
+  }
+
+  void merge(const glucose_histogram& o);
+
+  boost::uint64_t count() const { return count_; }
+
+  // The q quantile (0 <= q <= 1) by nearest rank: the smallest value with at
+  // least q * count() values up to it. Zero if there are no values.
+  unsigned short quantile(double q) const;
+};
+
+// Summarizes glucose readings per day, hour of the day, 15 minute slot of the
+// day, weekday or tag (or all together), in one pass. Other records are left
+// out. Aggregators of parts of the input can be merged, so the parts can be
+// summarized on separate threads.
+class record_aggregator : public record_visitor
+{
+public:
+  enum grouping_t { by_day, by_hour, by_weekday, by_tag, by_all, by_slot };
+
+  // The default target range, in mg/dL.
+  static const unsigned short default_low = 70, default_high = 180;
+
+private:
+  grouping_t grouping_;
+  unsigned short low_, high_;
+  std::vector<glucose_stats> buckets_; // per hour, slot, weekday or tag
+  std::map<long, glucose_stats> days_;
+  std::vector<double> percentiles_;
+  std::vector<glucose_histogram> histograms_; // if there are percentiles_
+  std::map<long, glucose_histogram> day_histograms_;
+
+  void add_to(size_t bucket, unsigned short value, bool in_range) {
+    buckets_[bucket].add(value, in_range);
+    if (!histograms_.empty())
+      histograms_[bucket].add(value);
+  }
+
+  // h is NULL if there are no percentiles.
+  void print_row(std::ostream& os, const std::string& key, const glucose_stats& s,
+    const glucose_histogram* h, bool json) const;
+
+public:
+  explicit record_aggregator(grouping_t grouping,
+    unsigned short low = default_low, unsigned short high = default_high);
+
+  // Also print the given percentiles (0 to 100) and the interquartile range
+  // of each group.
+  void set_percentiles(const std::vector<double>& percentiles);
+
+  void add(minutes_t minutes, unsigned short value, unsigned char tags, unsigned char tag2);
+  void add(const record& rec) { add(rec.minutes(), rec.value(), rec.tags(), rec.tag2()); }
+
+  // Add the given rows of table.
+  void add(const record_table& table, const record_table::row_t* b,
+    const record_table::row_t* e);
+
+  void visit(const record* b, const record* e);
+  void merge(const record_aggregator& o);
+
+  // Print a CSV line (key, count, mean, min, max, percent in range, and the
+  // percentiles if any) for every group with readings, after a heading line,
+  // or (if json) a JSON array with an object per group.
+  void print(std::ostream& os, bool json = false) const;
+};
+
+} // namespace contourpp
+
+#endif // CONTOURPP_AGGREGATE_H__
@@ -0,0 +1,140 @@
+#ifndef CONTOURPP_ARCHIVE_H__
+#define CONTOURPP_ARCHIVE_H__
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include "contourpp_driver.hpp"
+#include "contourpp_record_table.hpp"
+
+namespace contourpp
+{
+
+// Compact binary archive of records.
+//
+// An archive is a sequence of segments, one per meter dump, so archives can
+// simply be concatenated. All integers are little endian; "varint" is an
+// unsigned LEB128 and "svarint" a zigzag-encoded signed LEB128.
+//
+//   segment: "CTPA" | u8 version | meter_info | u32 crc32c(header) | block* | end
+//   meter_info: product, versions, serial, sku, each as varint size + bytes
+//   block: varint count (> 0) | varint payload size | u32 crc32c(payload) | payload
+//   end: varint 0 | trailer (since version 2)
+//   payload (columns of count records):
+//     minutes: svarint deltas, the first one from 0
+//     indices: svarint deltas, the first one from 0
+//     values: varint
+//     tags, tag2: count bytes each
+//
+// Blocks are self-contained, so each can be decoded (and verified) alone.
+//
+// The trailer indexes the blocks of the segment by time, so that range
+// queries only decode the blocks they need:
+//
+//   trailer: u32 size | index | u32 size | u32 crc32c(index)
+//   index: varint segment size (up to end) | varint count | entry*
+//   entry: varint offset delta | svarint min minutes delta | varint max - min
+//
+// Offsets are from the start of the segment and min minutes from 0, each
+// relative to the previous entry. Since the trailer ends with its size, the
+// segments can be found from the end of the archive without reading the
+// blocks.
+
+static const unsigned char archive_version = 2;
+
+// CRC-32C (Castagnoli) of [b, e).
+boost::uint32_t crc32c(const unsigned char* b, const unsigned char* e);
+
+// Writes records to an archive. Records passed to visit() are buffered and
+// written one block at a time; the segment header is written together with
+// the first block, so segments without records are left out.
+class archive_writer : public record_visitor
+{
+public:
+  static const size_t block_records = 4096;
+
+private:
+  std::ostream& os_;
+  meter_info info_;
+  bool in_segment_;
+  bool header_written_;
+  std::vector<record> pending_;
+  std::vector<unsigned char> buf_;
+  std::vector<unsigned char> index_;
+  size_t segment_size_, blocks_;
+  boost::uint32_t last_offset_, last_min_;
+
+  void write_header();
+  void write_block();
+
+  // Copy not allowed
+  archive_writer(const archive_writer&);
+  archive_writer & operator=(const archive_writer&);
+
+public:
+  explicit archive_writer(std::ostream& os)
+    : os_(os), in_segment_(false), header_written_(false),
+      segment_size_(0), blocks_(0), last_offset_(0), last_min_(0) {}
+
+  // Start a new segment (ending the current one) for records of a meter.
+  void begin_segment(const meter_info& info);
+  // Flush the buffered records and end the segment.
+  void end_segment();
+
+  void visit(const record* b, const record* e);
+  // Start a new segment, unless info is the meter of the current one.
+  void header(const meter_info& info);
+};
+
+// Reads an archive from memory, e.g. a mapped_file.
+class archive_reader
+{
+private:
+  const char* p_;
+  const char* e_;
+  meter_info info_;
+  unsigned version_;
+  bool in_segment_;
+
+  bool read_block_header(boost::uint32_t& n, const unsigned char*& payload,
+    const unsigned char*& payload_end, boost::uint32_t& crc);
+  bool skip_block();
+  void read_range(const char* segment, const unsigned char* index,
+    const unsigned char* index_end, minutes_t from, minutes_t to,
+    record_table& block, record_visitor& visitor);
+
+public:
+  archive_reader(const char* b, const char* e)
+    : p_(b), e_(e), version_(0), in_segment_(false) {}
+
+  // True if [b, e) starts like an archive.
+  static bool is_archive(const char* b, const char* e);
+
+  // Move to the next segment (skipping what is left of the current one).
+  // Returns false at the end of the archive.
+  bool next_segment();
+
+  // Meter of the current segment.
+  const meter_info& info() const { return info_; }
+
+  // Decode the next block of the current segment, appending its records to
+  // table. Returns false at the end of the segment. Throws
+  // std::runtime_error if the archive is truncated or corrupt.
+  bool next_block(record_table& table);
+
+  // Decode the rest of the archive, appending it to table.
+  void read_all(record_table& table);
+  // Decode the rest of the archive one block at a time, passing its records
+  // to visitor.
+  void read_all(record_visitor& visitor);
+
+  // Pass to visitor the records of the rest of the archive whose minutes
+  // are in [from, to]. Blocks out of the range are neither decoded nor
+  // verified, when the segments have an index.
+  void read_range(minutes_t from, minutes_t to, record_visitor& visitor);
+};
+
+} // namespace contourpp
+
+#endif // CONTOURPP_ARCHIVE_H__
@@ -0,0 +1,74 @@
+#ifndef CONTOURPP_DEDUP_H__
+#define CONTOURPP_DEDUP_H__
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include "contourpp_record_table.hpp"
+
+namespace contourpp
+{
+
+// The serial numbers of meters, as small integers from 1.
+class serial_ids
+{
+public:
+  typedef boost::uint32_t serial_t;
+
+private:
+  std::map<std::string, serial_t> ids_;
+
+public:
+  serial_t id(const std::string& serial);
+
+  // The ids of the meters of table, by meter_t.
+  void ids(const record_table& table, std::vector<serial_t>& ids);
+};
+
+// The readings seen so far, by meter serial number, record index and time,
+// e.g. to drop the history that each new download of a meter repeats. Kept
+// in an open-addressing hash table (linear probing), grown to stay at most
+// half full.
+class record_set
+{
+public:
+  typedef serial_ids::serial_t serial_t;
+
+private:
+  struct slot
+  {
+    minutes_t minutes;
+    boost::uint32_t index;
+    serial_t serial; // 0 if the slot is empty
+  };
+
+  std::vector<slot> slots_;
+  size_t size_;
+  serial_ids serials_;
+
+  void grow();
+
+public:
+  record_set();
+
+  // The id of a serial number, for insert().
+  serial_t serial_id(const std::string& serial) { return serials_.id(serial); }
+
+  // Add a reading. Returns false if it was in the set already.
+  bool insert(serial_t serial, minutes_t minutes, boost::uint32_t index);
+  bool insert(serial_t serial, const record& rec) {
+    return insert(serial, rec.minutes(), static_cast<boost::uint32_t>(rec.index()));
+  }
+
+  // Add the readings of the rows of table, keeping in rows only those that
+  // were not in the set (nor earlier in rows).
+  void filter(const record_table& table, std::vector<record_table::row_t>& rows);
+
+  size_t size() const { return size_; }
+};
+
+} // namespace contourpp
+
+#endif // CONTOURPP_DEDUP_H__
@@ -0,0 +1,26 @@
+#ifndef CONTOURPP_DIFF_H__
+#define CONTOURPP_DIFF_H__
+
+#include <cstddef>
+#include <vector>
+#include "contourpp_record_table.hpp"
+
+namespace contourpp
+{
+
+static const size_t hash_join_limit = 1 << 18;
+
+// The records of each of two tables that are not in the other, comparing
+// the meter serial number, index, time and value, e.g. to see what a new
+// download of a meter adds to an earlier one. The rows of only_a and only_b
+// keep their order in a and b (and their meters).
+//
+// If the smaller table has up to hash_join_limit rows, a hash table of its
+// records is probed with those of the larger one; otherwise both are radix
+// sorted (on up to jobs threads) and merged.
+void diff_tables(const record_table& a, const record_table& b, record_table& only_a,
+  record_table& only_b, size_t jobs = 1);
+
+} // namespace contourpp
+
+#endif // CONTOURPP_DIFF_H__
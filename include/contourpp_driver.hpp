@@ -1,10 +1,17 @@
 #ifndef CONTOURPP_DRIVER_H__
 #define CONTOURPP_DRIVER_H__
 
+#include <algorithm>
+#include <climits>
 #include <istream>
+#include <iterator>
 #include <ostream>
+#include <string>
+#include <utility>
 #include <vector>
+#include <boost/cstdint.hpp>
 #include <boost/date_time.hpp>
+#include "contourpp_time.hpp"
 //#include <boost/locale/date_time.hpp>
 //#include <boost/date_time/posix_time/posix_time.hpp>
 //#include <boost/date_time/posix_time/posix_time_io.hpp>
@@ -18,28 +25,73 @@ public:
   //typedef boost::locale::date_time datetime_t;
   typedef boost::posix_time::ptime datetime_t;
 
+  // minutes() of a record without a timestamp
+  static const minutes_t no_minutes = -2147483647 - 1;
+
+  // Record types, as bits so that several types can be selected at once.
+  // Glucose readings with after meal hours have both type_glucose and
+  // type_after_meal set.
+  enum type_bits {
+    type_glucose       =   1,
+    type_insulin_short =   2,
+    type_insulin_long  =   4,
+    type_carbs         =   8,
+    type_after_meal    =  16,
+    type_unknown       = 128
+  };
+
 private:
-  datetime_t datetime_;
-  size_t index_;
+  minutes_t minutes_;
+  boost::uint32_t index_;
   unsigned short value_;
   unsigned char tags_, tag2_;
 
   const char* get_bayer_type() const;
   const char* get_bayer_type2() const;
+  const char* parse_bayer_tags(const char* b, const char* e, char field_sep);
+  bool parse_bayer_datetime(const char* b, const char* e);
+  bool parse_csv_fields(const char* b, const char* const* f, size_t nf, const char* e);
+  bool parse_csv_datetime(const char* b, const char* e);
 
 public:
-  record() : index_(0), value_(0), tags_(0), tag2_(0) {}
+  record() : minutes_(no_minutes), index_(0), value_(0), tags_(0), tag2_(0) {}
 
   record(const record& o)
-    : datetime_(o.datetime_), index_(o.index_), value_(o.value_),
+    : minutes_(o.minutes_), index_(o.index_), value_(o.value_),
     tags_(o.tags_), tag2_(o.tag2_) {}
 
+  record& operator=(const record& o) {
+    minutes_ = o.minutes_;
+    index_ = o.index_;
+    value_ = o.value_;
+    tags_ = o.tags_;
+    tag2_ = o.tag2_;
+    return *this;
+  }
+
   record(const char* b, const char* e, char field_sep = '|')
   { parse_bayer(b, e, field_sep); }
 
-  const datetime_t& datetime() const { return datetime_; }
+  record(minutes_t minutes, size_t index, unsigned short value,
+    unsigned char tags, unsigned char tag2)
+    : minutes_(minutes), index_(index), value_(value), tags_(tags), tag2_(tag2) {}
+
+  // Type bits of a record with the given tags() and tag2().
+  static unsigned char type(unsigned char tags, unsigned char tag2) {
+    if ((tags & 128) == 0) return tag2? (type_glucose | type_after_meal) : type_glucose;
+    return (tag2 < 3)? (type_insulin_short << tag2) : type_unknown;
+  }
+
+  datetime_t datetime() const {
+    return (minutes_ == no_minutes)? datetime_t() : to_ptime(minutes_);
+  }
+  minutes_t minutes() const { return minutes_; }
   size_t index() const { return index_; }
+  void set_index(size_t index) { index_ = index; }
   unsigned short value() const { return value_; }
+  unsigned char tags() const { return tags_; }
+  unsigned char tag2() const { return tag2_; }
+  unsigned char type() const { return type(tags_, tag2_); }
   unsigned char min_after_meal() const { return is_glucose()? tag2_ : 0; }
   float hr_after_meal() const { return float(min_after_meal()) / 60; }
 
@@ -57,71 +109,66 @@ public:
   bool         is_carbs() const { return (tags_ & 128) && (tag2_ == 2); }
 
   void clear() {
-    datetime_ = datetime_t();
+    minutes_ = no_minutes;
     index_ = 0;
     value_ = 0;
     tags_ = 0;
     tag2_ = 0;
   }
 
-  void shift_time(const boost::posix_time::time_duration& d) { datetime_ += d; }
+  // Timestamps have minute resolution: a shift by a duration with seconds
+  // moves a record to the minute it would be printed with.
+  void shift_time(const boost::posix_time::time_duration& d) {
+    shift_minutes(static_cast<minutes_t>(floor_div(d.total_seconds(), 60)));
+  }
+  void shift_minutes(minutes_t m) { minutes_ += m; }
 
   bool parse_bayer(const char* b, const char* e, char field_sep = '|');
 
+  // Parse an R record whose field separators have already been located,
+  // e.g. by a structural_index: base + seps[0 .. nseps) are the separators
+  // in [b, e), in order, and b must point to the first one.
+  bool parse_bayer(const char* b, const char* e,
+    const unsigned int* seps, size_t nseps, const char* base);
+
+  // Longest text written by format_bayer() or format_csv().
+  static const size_t max_text_size = 96;
+
+  // The last date rendered by format_bayer() or format_csv(), as
+  // "YYYY-MM-DD", to reuse for the next records of the same day.
+  struct date_cache {
+    long day;
+    char text[10];
+
+    date_cache() : day(LONG_MAX), text() {}
+  };
+
+  // Render the record into p (which must have room for max_text_size
+  // characters), returning the end of the text.
+  char* format_bayer(char* p, char field_sep = '|', date_cache* dates = NULL) const;
+  char* format_csv(char* p, char field_sep = ',', date_cache* dates = NULL) const;
+
   template <typename _Elem, typename _Traits>
   void print_bayer(std::basic_ostream<_Elem,_Traits>& s, char field_sep = '|') const
   {
-    boost::posix_time::time_facet *facet = new boost::posix_time::time_facet("%Y%m%d%H%M");
-    s.imbue(std::locale(s.getloc(), facet));
-
-    s << 'R' << field_sep << index_ << field_sep << get_bayer_type()
-      << field_sep << value_ << field_sep << get_bayer_type2()
-      << field_sep << field_sep;
-
-    if (is_glucose()) {
-      static const char letters[] = "CBADISX";
-      bool attr_printed = false;
-      for (size_t i = 0; i < 7; i++) {
-        if (tags_ & (1 << i)) {
-          if (attr_printed) s << '/';
-          s << letters[i];
-          attr_printed = true;
-        }
-      }
-
-      if (tag2_ > 0) {
-        char c = static_cast<char>(static_cast<unsigned short>(tag2_) / 15);
-        c += (c > 9)? ('A' - 10) : '0';
-        if (attr_printed) s << '/';
-        s << 'Z' << c;
-      }
-    }
-
-    s << field_sep << field_sep << datetime_;
+    char buf[max_text_size];
+    std::copy(buf, format_bayer(buf, field_sep), std::ostreambuf_iterator<_Elem,_Traits>(s));
   }
 
+  // Parse a line printed by print_csv(), e.g. "2013-03-01 06:29,224,2,,,,,3.25".
+  // CSV has no record indices, so index() is left at 0.
   bool parse_csv(const char* b, const char* e, char field_sep = ',');
 
+  // Parse a CSV line [b, e) whose field separators have already been
+  // located: base + seps[0 .. nseps) are the separators in it, in order.
+  bool parse_csv(const char* b, const char* e,
+    const unsigned int* seps, size_t nseps, const char* base);
+
   template <typename _Elem, typename _Traits>
   void print_csv(std::basic_ostream<_Elem,_Traits>& s, char field_sep = ',') const
   {
-    boost::posix_time::time_facet *facet = new boost::posix_time::time_facet("%Y-%m-%d %H:%M");
-    s.imbue(std::locale(s.getloc(), facet));
-
-    s << datetime_ << field_sep << value_;
-
-    if (is_glucose()) {
-      s << field_sep << (is_before_food()? "1" : (is_after_food()? "2" : ""))
-        << field_sep << (dont_feel_right()? "1" : "")
-        << field_sep << (is_sick()? "1" : "")
-        << field_sep << (has_stress()? "1" : "")
-        << field_sep << (has_activity()? "1" : "");
-
-      if (tag2_)
-        s << field_sep << hr_after_meal();
-    }
-    else
-      s << field_sep << (-1 - static_cast<int>(tag2_));
+    char buf[max_text_size];
+    std::copy(buf, format_csv(buf, field_sep), std::ostreambuf_iterator<_Elem,_Traits>(s));
   }
 
   template <typename _Elem, typename _Traits>
@@ -134,8 +181,51 @@ public:
 }; // class record
 
 
+// Description of a meter, from the header (H) record of its dump.
+struct meter_info
+{
+  std::string product, versions, serial, sku;
+
+  bool operator == (const meter_info& o) const {
+    return (serial == o.serial) && (product == o.product) &&
+      (versions == o.versions) && (sku == o.sku);
+  }
+  bool operator != (const meter_info& o) const { return !(*this == o); }
+};
+
+
+// Receives parsed records in input order, a small batch at a time.
+// header() is called whenever a header record starts a new meter dump;
+// the records visited after it come from that meter.
+class record_visitor
+{
+public:
+  virtual ~record_visitor() {}
+  virtual void visit(const record* b, const record* e) = 0;
+  virtual void header(const meter_info&) {}
+};
+
+
+// A record_visitor that appends the records to a vector.
+class record_appender : public record_visitor
+{
+private:
+  std::vector<record>& records_;
+
+public:
+  explicit record_appender(std::vector<record>& records) : records_(records) {}
+
+  void visit(const record* b, const record* e) {
+    records_.insert(records_.end(), b, e);
+  }
+};
+
+
 class record_parser
 {
+public:
+  typedef std::pair<const char*, const char*> line_t;
+
 private:
   char field_sep_;
   char repeat_sep_;
@@ -144,6 +234,7 @@ private:
   std::string password_;
   std::string product_, versions_, serial_, sku_, device_info_, patient_info_;
   size_t result_count_;
+  size_t csv_count_;
 
   bool parse_H(const char* b, const char* e);
   bool parse_P(const char* b, const char* e);
@@ -152,14 +243,58 @@ private:
     return rec.parse_bayer(b, e, field_sep_);
   }
 
+  bool same_delimiters(const record_parser& o) const {
+    return (field_sep_ == o.field_sep_) && (repeat_sep_ == o.repeat_sep_) &&
+      (comp_sep_ == o.comp_sep_) && (escape_sep_ == o.escape_sep_);
+  }
+
 public:
   record_parser()
     : field_sep_('|'), repeat_sep_('\\'), comp_sep_('^'),
-    escape_sep_('&'), result_count_(0) {}
+    escape_sep_('&'), result_count_(0), csv_count_(0) {}
+
+  // Meter description from the last header parsed.
+  meter_info info() const;
 
   bool parse(const char* b, const char* e, record& rec);
+
+  // Parse every newline-terminated line in [b, e) and append the records
+  // found to records. Returns the number of records appended.
+  size_t parse_all(const char* b, const char* e, std::vector<record>& records);
+
+  // Parse every newline-terminated line in [b, e), passing the records found
+  // to visitor as they are parsed. Returns the number of records visited.
+  size_t parse_all(const char* b, const char* e, record_visitor& visitor);
+
+  // parse_all(), also collecting the non-record (H, P, L, ...) lines if
+  // others is not NULL.
+  size_t parse_lines(const char* b, const char* e, record_visitor& visitor,
+    std::vector<line_t>* others);
+
+  // Like parse_all(), but split [b, e) into newline-aligned chunks that are
+  // parsed on up to jobs threads. The records are passed to visitor in input
+  // order once all chunks are parsed, and the parser ends in the same state
+  // as after a sequential parse_all().
+  size_t parse_all(const char* b, const char* e, record_visitor& visitor, size_t jobs);
+
   void get_all(std::istream& is, std::vector<record>& records);
   void get_all(std::vector<record>& records);
+
+  // Streaming versions of get_all(): records are passed to visitor as they
+  // are read, instead of being collected.
+  void get_all(std::istream& is, record_visitor& visitor);
+  void get_all(record_visitor& visitor);
+
+  // True if [b, e) starts like CSV (as printed by record::print_csv())
+  // rather than like Bayer's format, whose lines start with a letter.
+  static bool is_csv(const char* b, const char* e);
+
+  // Versions of parse_all() and get_all() for CSV input. The records are
+  // numbered from 1 in input order, continuing across calls. Empty lines are
+  // skipped, and other lines that are not CSV records are an error.
+  size_t parse_all_csv(const char* b, const char* e, record_visitor& visitor);
+  size_t parse_all_csv(const char* b, const char* e, record_visitor& visitor, size_t jobs);
+  void get_all_csv(std::istream& is, record_visitor& visitor);
 };
 
 } // namespace contourpp
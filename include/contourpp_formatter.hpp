@@ -0,0 +1,86 @@
+#ifndef CONTOURPP_FORMATTER_H__
+#define CONTOURPP_FORMATTER_H__
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+#include "contourpp_driver.hpp"
+#include "contourpp_rolling.hpp"
+
+namespace contourpp
+{
+
+// Prints records as text, one per line. The lines are rendered into a large
+// buffer, which is written out in one piece when it fills up (or on
+// flush()), instead of going through the stream record by record. The
+// output is the same as that of record::print_csv() and print_bayer(); the
+// date is rendered once for each run of records of the same day.
+class record_formatter
+{
+public:
+  static const size_t default_buffer_size = 256 * 1024;
+
+private:
+  std::ostream& os_;
+  std::vector<char> buf_;
+  size_t size_;
+  record::date_cache dates_;
+
+  char* reserve(size_t n = record::max_text_size) {
+    if (buf_.size() - size_ <= n)
+      flush();
+    if (buf_.size() <= n)
+      buf_.resize(n + 1);
+    return &buf_[size_];
+  }
+
+  // Start a line with a field of mark.
+  char* marked(char mark, char field_sep) {
+    char* p = reserve(record::max_text_size + 2);
+    *p++ = mark;
+    *p++ = field_sep;
+    return p;
+  }
+
+  void commit(char* e) {
+    *e++ = '\n';
+    size_ = e - &buf_[0];
+  }
+
+  // Copy not allowed
+  record_formatter(const record_formatter&);
+  record_formatter & operator=(const record_formatter&);
+
+public:
+  explicit record_formatter(std::ostream& os, size_t buffer_size = default_buffer_size);
+  ~record_formatter() { flush(); }
+
+  void csv(const record& rec, char field_sep = ',') {
+    commit(rec.format_csv(reserve(), field_sep, &dates_));
+  }
+
+  // A CSV line with the count, mean, sd, min, max and rate of change (per
+  // hour) of each of n windows appended (empty for windows with a count of
+  // 0). The after meal field is always there, so that the columns line up.
+  void csv(const record& rec, const rolling_stats* stats, size_t n, char field_sep = ',');
+
+  void bayer(const record& rec, char field_sep = '|') {
+    commit(rec.format_bayer(reserve(), field_sep, &dates_));
+  }
+
+  // A line of csv() or bayer() with a first field of mark, e.g. '+'.
+  void csv(char mark, const record& rec, char field_sep = ',') {
+    commit(rec.format_csv(marked(mark, field_sep), field_sep, &dates_));
+  }
+
+  void bayer(char mark, const record& rec, char field_sep = '|') {
+    commit(rec.format_bayer(marked(mark, field_sep), field_sep, &dates_));
+  }
+
+  // Write out the buffered lines.
+  void flush();
+};
+
+} // namespace contourpp
+
+#endif // CONTOURPP_FORMATTER_H__
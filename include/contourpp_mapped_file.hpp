@@ -0,0 +1,56 @@
+#ifndef CONTOURPP_MAPPED_FILE_H__
+#define CONTOURPP_MAPPED_FILE_H__
+
+#include <cstddef>
+#include <vector>
+
+namespace contourpp
+{
+
+// Read-only view of a whole input file. Regular files are memory-mapped with
+// a sequential access hint, so the parser works directly on the page cache.
+// Pipes, terminals and stdin ("-") cannot be mapped and are read into an
+// owned buffer instead.
+class mapped_file
+{
+private:
+  std::vector<char> buffer_;
+  void* map_;
+  size_t map_size_;
+  const char* begin_;
+  const char* end_;
+  bool open_;
+
+  bool map(int fd);
+  void read(int fd, const char* filename);
+
+  // Copy not allowed
+  mapped_file(const mapped_file&);
+  mapped_file & operator=(const mapped_file&);
+
+public:
+  mapped_file()
+    : map_(NULL), map_size_(0), begin_(NULL), end_(NULL), open_(false) {}
+
+  explicit mapped_file(const char* filename)
+    : map_(NULL), map_size_(0), begin_(NULL), end_(NULL), open_(false)
+  { open(filename); }
+
+  ~mapped_file() { close(); }
+
+  inline bool is_open() const { return open_; }
+  inline bool is_mapped() const { return map_ != NULL; }
+
+  // Open (and map or read) a file; "-" stands for stdin.
+  // Throws std::runtime_error if the file cannot be opened or read.
+  bool open(const char* filename);
+  bool close();
+
+  const char* begin() const { return begin_; }
+  const char* end() const { return end_; }
+  size_t size() const { return end_ - begin_; }
+};
+
+} // namespace contourpp
+
+#endif // CONTOURPP_MAPPED_FILE_H__
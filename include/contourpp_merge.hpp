@@ -0,0 +1,96 @@
+#ifndef CONTOURPP_MERGE_H__
+#define CONTOURPP_MERGE_H__
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "contourpp_archive.hpp"
+#include "contourpp_driver.hpp"
+#include "contourpp_record_table.hpp"
+
+namespace contourpp
+{
+
+// An input of merge_records(): its records are read a batch at a time, and
+// taken one at a time with peek() and pop().
+class record_source : public record_visitor
+{
+private:
+  std::vector<record> batch_;
+  std::vector<std::pair<size_t, meter_info> > headers_; // before batch_[first]
+  size_t next_, next_header_;
+  meter_info info_;
+
+protected:
+  // Read the next batch, passing it to visit() and header(). Returns false
+  // at the end of the input.
+  virtual bool fill() = 0;
+
+public:
+  record_source() : next_(0), next_header_(0) {}
+
+  void visit(const record* b, const record* e) { batch_.insert(batch_.end(), b, e); }
+  void header(const meter_info& info) { headers_.push_back(std::make_pair(batch_.size(), info)); }
+
+  // The next record, or NULL at the end of the input.
+  const record* peek() {
+    if ((next_ == batch_.size()) && !refill())
+      return NULL;
+    while ((next_header_ < headers_.size()) && (headers_[next_header_].first <= next_))
+      info_ = headers_[next_header_++].second;
+    return &batch_[next_];
+  }
+
+  void pop() { ++next_; }
+
+  // The meter of the record from peek().
+  const meter_info& info() const { return info_; }
+
+private:
+  bool refill();
+};
+
+// The records of Bayer's format or CSV text, parsed a chunk at a time.
+class text_source : public record_source
+{
+public:
+  static const size_t chunk_size = 64 * 1024;
+
+private:
+  const char *p_, *e_;
+  bool csv_;
+  record_parser parser_;
+
+protected:
+  bool fill();
+
+public:
+  text_source(const char* b, const char* e, bool csv) : p_(b), e_(e), csv_(csv) {}
+};
+
+// The records of an archive, decoded a block at a time.
+class archive_source : public record_source
+{
+private:
+  archive_reader reader_;
+  record_table block_;
+  bool in_segment_;
+
+protected:
+  bool fill();
+
+public:
+  archive_source(const char* b, const char* e) : reader_(b, e), in_segment_(false) {}
+};
+
+// Pass the records of the sources to visitor in time order (and by index for
+// the same time, if by_index), given that each source is in that order,
+// keeping only a batch of each in memory. Records that are otherwise equal
+// keep the order of their sources. visitor.header() is called whenever the
+// meter of the records changes.
+void merge_records(const std::vector<record_source*>& sources, record_visitor& visitor,
+  bool by_index = false);
+
+} // namespace contourpp
+
+#endif // CONTOURPP_MERGE_H__
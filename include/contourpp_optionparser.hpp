@@ -2,9 +2,15 @@
 #define CONTOURPP_OPTIONPARSER_H__
 
 #include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <iostream>
 #include <iterator>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
 #include "optionparser.h"
+#include "contourpp_time.hpp"
 
 struct Arg: public option::Arg
 {
@@ -57,6 +63,133 @@ struct Arg: public option::Arg
     return option::ARG_ILLEGAL;
   }
 
+  static option::ArgStatus Positive(const option::Option& option, bool msg)
+  {
+    char* endptr = 0;
+    if (option.arg != 0) {
+      errno = 0;
+      const long n = strtol(option.arg, &endptr, 10);
+      if (endptr != option.arg && *endptr == 0 && errno == 0 && n > 0 && n < INT_MAX)
+        return option::ARG_OK;
+    }
+
+    if (msg)
+      printError("Option '", option, "' requires a positive number\n");
+    return option::ARG_ILLEGAL;
+  }
+
+  static option::ArgStatus OutputFormat(const option::Option& option, bool msg)
+  {
+    if (option.arg != 0 && (!strcmp(option.arg, "csv") || !strcmp(option.arg, "bayer") ||
+        !strcmp(option.arg, "archive") || !strcmp(option.arg, "json")))
+      return option::ARG_OK;
+
+    if (msg)
+      printError("Option '", option, "' has to be one of csv, bayer, archive or json\n");
+    return option::ARG_ILLEGAL;
+  }
+
+  static option::ArgStatus InputFormat(const option::Option& option, bool msg)
+  {
+    if (option.arg != 0 && (!strcmp(option.arg, "auto") || !strcmp(option.arg, "bayer") ||
+        !strcmp(option.arg, "csv") || !strcmp(option.arg, "archive")))
+      return option::ARG_OK;
+
+    if (msg)
+      printError("Option '", option, "' has to be one of auto, bayer, csv or archive\n");
+    return option::ARG_ILLEGAL;
+  }
+
+  static option::ArgStatus Aggregate(const option::Option& option, bool msg)
+  {
+    if (option.arg != 0 && (!strcmp(option.arg, "day") || !strcmp(option.arg, "hour") ||
+        !strcmp(option.arg, "slot") || !strcmp(option.arg, "weekday") ||
+        !strcmp(option.arg, "tag") || !strcmp(option.arg, "all")))
+      return option::ARG_OK;
+
+    if (msg)
+      printError("Option '", option, "' has to be one of day, hour, slot, weekday, tag or all\n");
+    return option::ARG_ILLEGAL;
+  }
+
+  // Parse a comma separated list of percentiles (each > 0 and <= 100).
+  static bool parsePercentiles(const char* str, std::vector<double>& percentiles)
+  {
+    percentiles.clear();
+    for (;;) {
+      char* endptr = NULL;
+      const double p = strtod(str, &endptr);
+      if (endptr == str || !(p > 0 && p <= 100))
+        return false;
+      percentiles.push_back(p);
+      if (*endptr == 0)
+        return true;
+      if (*endptr != ',')
+        return false;
+      str = endptr + 1;
+    }
+  }
+
+  // Parse a comma separated list of window widths, each a number of minutes,
+  // hours or days, e.g. 90m,3h,7d.
+  static bool parseWindows(const char* str, std::vector<contourpp::minutes_t>& widths)
+  {
+    widths.clear();
+    for (;;) {
+      char* endptr = NULL;
+      const long n = strtol(str, &endptr, 10);
+      if (endptr == str || n <= 0 || n > 3660 * 24)
+        return false;
+      switch (*endptr++) {
+        case 'm': widths.push_back(n); break;
+        case 'h': widths.push_back(n * 60); break;
+        case 'd': widths.push_back(n * contourpp::minutes_per_day); break;
+        default: return false;
+      }
+      if (*endptr == 0)
+        return true;
+      if (*endptr != ',')
+        return false;
+      str = endptr + 1;
+    }
+  }
+
+  static option::ArgStatus Windows(const option::Option& option, bool msg)
+  {
+    std::vector<contourpp::minutes_t> widths;
+    if (option.arg != 0 && parseWindows(option.arg, widths))
+      return option::ARG_OK;
+
+    if (msg)
+      printError("Option '", option, "' has to be a list of windows, e.g. 90m,3h,7d\n");
+    return option::ARG_ILLEGAL;
+  }
+
+  // An optional list of percentiles, given as --percentiles=<list>.
+  static option::ArgStatus Percentiles(const option::Option& option, bool msg)
+  {
+    std::vector<double> percentiles;
+    if (option.arg == 0 || option.name[option.namelen] == 0)
+      return option::ARG_IGNORE;
+    if (parsePercentiles(option.arg, percentiles))
+      return option::ARG_OK;
+
+    if (msg)
+      printError("Option '", option, "' has to be a list of percentiles, e.g. 10,50,90\n");
+    return option::ARG_ILLEGAL;
+  }
+
+  static option::ArgStatus DateTime(const option::Option& option, bool msg)
+  {
+    contourpp::minutes_t m, span;
+    if (option.arg != 0 && contourpp::parse_minutes(option.arg, m, span))
+      return option::ARG_OK;
+
+    if (msg)
+      printError("Option '", option, "' has to be formatted as YYYY-MM-DD[ HH:MM]\n");
+    return option::ARG_ILLEGAL;
+  }
+
   static option::ArgStatus TimeDuration(const option::Option& option, bool msg)
   {
     const char* str = option.arg;
@@ -112,6 +245,24 @@ enum optionIndex {
   PRINTINSULINSHORT,
   PRINTINSULINLONG,
   PRINTCARBS,
+  JOBS,
+  STREAM,
+  OUTPUTFORMAT,
+  FROM,
+  TO,
+  INPUTFORMAT,
+  WHERE,
+  AGGREGATE,
+  PERCENTILES,
+  AGP,
+  ROLLING,
+  TIMEZONE,
+  METERTIMEZONE,
+  MERGE,
+  SORT,
+  SORTMEMORY,
+  DEDUP,
+  DIFF,
 };
 
 
@@ -129,15 +280,60 @@ static const option::Descriptor usage[] =
   {OLDFORMAT,     0, "B", "bayer-format",    Arg::None,
     "  -B  \t--bayer-format  \tPrint output in the Bayer format (as given by the meter)." },
 
+  {OUTPUTFORMAT,  0, "o", "output-format",   Arg::OutputFormat,
+    "  -o <format>  \t--output-format=<format>  \tPrint output as csv (the default), bayer (same as -B) or archive"
+    " (binary, compact; archives are recognized as input files). Summaries (--aggregate, --agp) can also be"
+    " printed as json." },
+
   {AFTERMEALONLY, 0, "a", "after-meal-only", Arg::None,
     "  -a  \t--after-meal-only  \tPrint only entries with after meal hours." },
 
   {INFILE,        0, "f", "input-file",      Arg::NonEmpty,
-    "  -f <input_file>  \t--input-file=<input_file>  \tRead the entries from the infile." },
+    "  -f <input_file>  \t--input-file=<input_file>  \tRead the entries from the infile (\"-\" reads from stdin)." },
+
+  {INPUTFORMAT,   0, "",  "input-format",    Arg::InputFormat,
+    "  \t--input-format=<format>  \tRead the input files as bayer (as given by the meter), csv (as printed by contourpp),"
+    " archive, or auto (the default) to tell from their contents." },
 
   {TIMESHIFT,     0, "t", "time-shift",      Arg::TimeDuration,
     "  -t <timeshift>  \t--time-shift=<timeshift>  \tShift the time of each reading (timeshift format: [-]HH:MM[:SS])." },
 
+  {METERTIMEZONE, 0, "",  "meter-time-zone", Arg::NonEmpty,
+    "  \t--meter-time-zone=<zone>  \tThe time zone of the meter clock, e.g. Europe/Athens (default: UTC)." },
+
+  {TIMEZONE,      0, "",  "time-zone",       Arg::NonEmpty,
+    "  \t--time-zone=<zone>  \tConvert the times (after --time-shift) from the meter time zone to this one, taking"
+    " daylight saving time into account (default: UTC). Zones are read from the tzdata files." },
+
+  {FROM,          0, "",  "from",            Arg::DateTime,
+    "  \t--from=<time>  \tPrint only entries at or after time (time format: YYYY-MM-DD[ HH:MM])." },
+
+  {TO,            0, "",  "to",              Arg::DateTime,
+    "  \t--to=<time>  \tPrint only entries up to time (a date includes the whole day)." },
+
+  {WHERE,         0, "w", "where",           Arg::NonEmpty,
+    "  -w <condition>  \t--where=<condition>  \tPrint only entries that meet the condition, e.g. \"value > 180 && after_food\"."
+    " Fields: value, index, year, month, day, weekday (0 is Sunday), hour, minute, meal_minutes;"
+    " flags: glucose, insulin_short, insulin_long, carbs, after_meal, control, before_food, after_food,"
+    " dont_feel_right, sick, stress, activity. Operators: < <= > >= == != between..and, && || ! ( )." },
+
+  {AGGREGATE,     0, "",  "aggregate",       Arg::Aggregate,
+    "  \t--aggregate=<group>  \tInstead of the entries, print the count, mean, min, max and percent in range (70-180)"
+    " of the glucose readings per day, hour, slot (15 minutes of the day), weekday, tag or all together." },
+
+  {PERCENTILES,   0, "",  "percentiles",     Arg::Percentiles,
+    "  \t--percentiles[=<list>]  \tAdd the given percentiles (default: 25,50,75) and the interquartile range to"
+    " --aggregate (which defaults to all)." },
+
+  {AGP,           0, "",  "agp",             Arg::None,
+    "  \t--agp  \tPrint the Ambulatory Glucose Profile: the 5th, 25th, 50th, 75th and 95th percentiles of the glucose"
+    " readings per 15 minutes of the day (same as --aggregate=slot --percentiles=5,25,50,75,95)." },
+
+  {ROLLING,       0, "",  "rolling",         Arg::Windows,
+    "  \t--rolling=<windows>  \tAppend to each glucose entry the count, mean, standard deviation, min, max and rate"
+    " of change (per hour) of the glucose readings in the window of time that ends with it, for each of the windows"
+    " (e.g. 90m,3h,7d). A reading older than the one before it starts the windows over. csv output only." },
+
   {PRINTGLUCOSE, 0, "g", "glucose", Arg::None,
     "  -g  \t--glucose-only  \tPrint glucose entries." },
 
@@ -150,11 +346,43 @@ static const option::Descriptor usage[] =
   {PRINTCARBS, 0, "c", "carbs", Arg::None,
     "  -c  \t--carbs  \tPrint carbs entries." },
 
+  {JOBS, 0, "j", "jobs", Arg::Positive,
+    "  -j <n>  \t--jobs=<n>  \tParse the input on up to n threads (default: one per core)." },
+
+  {STREAM, 0, "s", "stream", Arg::None,
+    "  -s  \t--stream  \tPrint the entries while reading them, in constant memory (single-threaded)." },
+
+  {MERGE, 0, "m", "merge", Arg::None,
+    "  -m  \t--merge  \tMerge the input files, each in time order, into one time ordered list of entries (streaming,"
+    " in memory proportional to the number of files)." },
+
+  {SORT, 0, "", "sort", Arg::None,
+    "  \t--sort  \tPrint the entries sorted by time, then index. All the entries are sorted in memory, unless"
+    " with -s, -m or --sort-memory." },
+
+  {SORTMEMORY, 0, "", "sort-memory", Arg::Positive,
+    "  \t--sort-memory=<MiB>  \tSort in bounded memory (default: 256): runs of entries that fill the memory"
+    " are sorted and spilled to temporary files, then merged." },
+
+  {DEDUP, 0, "", "dedup", Arg::None,
+    "  \t--dedup  \tDrop the entries already read from the same meter (by serial number, index and time), e.g."
+    " to join overlapping downloads." },
+
+  {DIFF, 0, "", "diff", Arg::None,
+    "  \t--diff  \tWith two input files A and B, print the entries of A that are not in B, marked \"-\", then those"
+    " of B that are not in A, marked \"+\" (comparing serial number, index, time and value)." },
+
   {UNKNOWN,       0, "" , "",                Arg::None,
     "\nExamples:\n"
     "  contourpp                          Get readings from the Contour USB meter and output them in csv.\n"
     "  contourpp -t 04:00 readings.txt    Get readings from \"readings.txt\" and correct time by shifting them by 4 hours.\n"
-    "  contourpp -a readings.txt          Filter readings from \"readings.txt\", printing only the ones with after meal hours.\n" },
+    "  contourpp -a readings.txt          Filter readings from \"readings.txt\", printing only the ones with after meal hours.\n"
+    "  contourpp -o archive readings.txt > readings.ctpa\n"
+    "                                     Store the readings from \"readings.txt\" in a compact archive.\n"
+    "  contourpp --from=2013-03-01 --to=2013-03-31 readings.ctpa\n"
+    "                                     Print the readings of March 2013 from the archive \"readings.ctpa\".\n"
+    "  contourpp -w \"value > 180 && hour between 22 and 6\" readings.txt\n"
+    "                                     Print the readings over 180 taken at night.\n" },
   {0,0,0,0,0,0}
  };
 
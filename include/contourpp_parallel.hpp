@@ -0,0 +1,111 @@
+#ifndef CONTOURPP_PARALLEL_H__
+#define CONTOURPP_PARALLEL_H__
+
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/thread.hpp>
+
+namespace contourpp
+{
+
+// Number of worker threads to use by default (one per core).
+inline size_t default_jobs()
+{
+  const size_t n = boost::thread::hardware_concurrency();
+  return n? n : 1;
+}
+
+namespace detail
+{
+
+template <typename F>
+class parallel_for_worker
+{
+private:
+  F& f_;
+  size_t n_;
+  size_t& next_;
+  boost::mutex& mutex_;
+  std::vector<std::string>& errors_;
+  std::vector<char>& failed_;
+
+public:
+  parallel_for_worker(F& f, size_t n, size_t& next, boost::mutex& mutex,
+    std::vector<std::string>& errors, std::vector<char>& failed)
+    : f_(f), n_(n), next_(next), mutex_(mutex), errors_(errors), failed_(failed) {}
+
+  void operator()()
+  {
+    for (;;) {
+      size_t i;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (next_ >= n_)
+          return;
+        i = next_++;
+      }
+
+      try {
+        f_(i);
+      }
+      catch (const std::exception& e) {
+        errors_[i] = e.what();
+        failed_[i] = 1;
+      }
+      catch (...) {
+        errors_[i] = "unknown error";
+        failed_[i] = 1;
+      }
+    }
+  }
+};
+
+} // namespace detail
+
+// Call f(i) for each i in [0, n) on up to jobs threads. Items are handed out
+// one at a time, so items of uneven size balance out across the workers.
+// f must be safe to call concurrently for different items. If any item
+// throws, the error of the first such item (in item order) is rethrown as a
+// std::runtime_error once all workers are done.
+template <typename F>
+void parallel_for(size_t n, size_t jobs, F& f)
+{
+  if (jobs > n)
+    jobs = n;
+
+  // Items run in order here, so the first to throw is the one reported.
+  if (jobs <= 1) {
+    for (size_t i = 0; i < n; ++i) {
+      try {
+        f(i);
+      }
+      catch (const std::exception& e) {
+        throw std::runtime_error(e.what());
+      }
+      catch (...) {
+        throw std::runtime_error("unknown error");
+      }
+    }
+    return;
+  }
+
+  size_t next = 0;
+  boost::mutex mutex;
+  std::vector<std::string> errors(n);
+  std::vector<char> failed(n, 0);
+  boost::thread_group threads;
+
+  for (size_t j = 0; j < jobs; ++j)
+    threads.create_thread(detail::parallel_for_worker<F>(f, n, next, mutex, errors, failed));
+  threads.join_all();
+
+  for (size_t i = 0; i < n; ++i)
+    if (failed[i])
+      throw std::runtime_error(errors[i]);
+}
+
+} // namespace contourpp
+
+#endif // CONTOURPP_PARALLEL_H__
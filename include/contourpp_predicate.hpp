@@ -0,0 +1,84 @@
+#ifndef CONTOURPP_PREDICATE_H__
+#define CONTOURPP_PREDICATE_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include "contourpp_driver.hpp"
+#include "contourpp_record_table.hpp"
+
+namespace contourpp
+{
+
+// A condition on records, compiled from an expression such as
+//
+//   value > 180 && after_food && hour between 22 and 6
+//
+// Comparisons (<, <=, >, >=, ==, !=) and ranges ("x between a and b", which
+// wraps around when a > b) test a field against integers:
+//
+//   value, index, year, month, day, weekday (0 is Sunday), hour, minute,
+//   meal_minutes (minutes after meal, 0 if none)
+//
+// and flags test the record type and tags: glucose, insulin_short,
+// insulin_long, carbs, after_meal, control, before_food, after_food,
+// dont_feel_right, sick, stress, activity. They combine with "&&" (or "and"),
+// "||" ("or"), "!" ("not") and parentheses.
+//
+// The expression is compiled into a small stack program, whose instructions
+// each run over a batch of records, field column by field column.
+class record_predicate
+{
+public:
+  static const size_t batch_size = 1024;
+
+  // Throws std::runtime_error if expression is not valid.
+  explicit record_predicate(const std::string& expression);
+
+  // Keep in rows only the rows of table that match.
+  void filter(const record_table& table, std::vector<record_table::row_t>& rows) const;
+
+  // Set match[i] to whether b[i] matches, for each record in [b, e).
+  void evaluate(const record* b, const record* e, unsigned char* match) const;
+
+  // The fields and flags, as used in instructions.
+  enum field_t {
+    field_value, field_index, field_year, field_month, field_day, field_weekday,
+    field_hour, field_minute, field_meal_minutes, field_count
+  };
+
+  enum flag_t {
+    flag_glucose, flag_insulin_short, flag_insulin_long, flag_carbs,
+    flag_after_meal, flag_control, flag_before_food, flag_after_food,
+    flag_dont_feel_right, flag_sick, flag_stress, flag_activity
+  };
+
+private:
+  enum opcode_t {
+    op_lt, op_le, op_gt, op_ge, op_eq, op_ne, op_between, op_flag,
+    op_and, op_or, op_not
+  };
+
+  struct instruction
+  {
+    opcode_t op;
+    int arg; // field_t or flag_t
+    long a, b;
+
+    instruction(opcode_t o, int x = 0, long y = 0, long z = 0)
+      : op(o), arg(x), a(y), b(z) {}
+  };
+
+  struct batch;
+  class compiler;
+
+  std::vector<instruction> code_;
+  size_t depth_;
+
+  void run(batch& in, unsigned char* match) const;
+};
+
+} // namespace contourpp
+
+#endif // CONTOURPP_PREDICATE_H__
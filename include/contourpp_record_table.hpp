@@ -0,0 +1,85 @@
+#ifndef CONTOURPP_RECORD_TABLE_H__
+#define CONTOURPP_RECORD_TABLE_H__
+
+#include <vector>
+#include <boost/cstdint.hpp>
+#include "contourpp_driver.hpp"
+
+namespace contourpp
+{
+
+// Column store of records: each field of record is kept in its own
+// contiguous array, so scans over one field (time, value, type) only touch
+// the bytes of that field. A record_table is a record_visitor, so a
+// record_parser can append into it directly.
+//
+// Each row also refers to the meter it came from: header() starts a new
+// meter for the rows appended after it. Meter 0 stands for records that
+// precede any header.
+class record_table : public record_visitor
+{
+public:
+  typedef boost::uint32_t row_t;
+  typedef boost::uint32_t meter_t;
+
+private:
+  std::vector<minutes_t> minutes_;
+  std::vector<boost::uint32_t> indices_;
+  std::vector<unsigned short> values_;
+  std::vector<unsigned char> tags_, tag2_;
+  std::vector<meter_t> meter_ids_;
+  std::vector<meter_info> meters_;
+  meter_t meter_;
+
+public:
+  record_table() : meters_(1), meter_(0) {}
+
+  size_t size() const { return minutes_.size(); }
+  bool empty() const { return minutes_.empty(); }
+
+  void clear();
+  void reserve(size_t n);
+
+  void push_back(const record& rec);
+  void append(const record* b, const record* e);
+  void append(const record_table& o);
+  void visit(const record* b, const record* e) { append(b, e); }
+  void header(const meter_info& info);
+
+  record operator[](size_t i) const {
+    return record(minutes_[i], indices_[i], values_[i], tags_[i], tag2_[i]);
+  }
+
+  // Add n rows at the end, to be filled in through the columns, and return
+  // the first of them.
+  size_t grow(size_t n);
+
+  // Pass the rows [b, e) to visitor as records, calling visitor.header()
+  // whenever the meter changes.
+  void replay(size_t b, size_t e, record_visitor& visitor) const;
+
+  // Columns
+  const minutes_t* minutes() const { return minutes_.data(); }
+  const boost::uint32_t* indices() const { return indices_.data(); }
+  const unsigned short* values() const { return values_.data(); }
+  const unsigned char* tags() const { return tags_.data(); }
+  const unsigned char* tag2() const { return tag2_.data(); }
+  const meter_t* meter_ids() const { return meter_ids_.data(); }
+  const std::vector<meter_info>& meters() const { return meters_; }
+
+  minutes_t* minutes() { return minutes_.data(); }
+  boost::uint32_t* indices() { return indices_.data(); }
+  unsigned short* values() { return values_.data(); }
+  unsigned char* tags() { return tags_.data(); }
+  unsigned char* tag2() { return tag2_.data(); }
+  meter_t* meter_ids() { return meter_ids_.data(); }
+
+  void shift_minutes(minutes_t m);
+
+  // Append to rows the rows whose record::type() has any of the bits of mask.
+  void select(unsigned char mask, std::vector<row_t>& rows) const;
+};
+
+} // namespace contourpp
+
+#endif // CONTOURPP_RECORD_TABLE_H__
@@ -0,0 +1,58 @@
+#ifndef CONTOURPP_ROLLING_H__
+#define CONTOURPP_ROLLING_H__
+
+#include <cstddef>
+#include <deque>
+#include <boost/cstdint.hpp>
+#include "contourpp_time.hpp"
+
+namespace contourpp
+{
+
+// Statistics of the glucose values in a window of time.
+struct rolling_stats
+{
+  size_t count;
+  double mean, sd;         // sd of the population
+  unsigned short min, max;
+  double rate;             // change per hour since the oldest value
+  bool has_rate;           // false if all values are of the same minute
+
+  rolling_stats() : count(0), mean(0), sd(0), min(0), max(0), rate(0), has_rate(false) {}
+};
+
+// Statistics of the values added in the last width minutes, updated as each
+// value is added in amortized O(1): running sums give the mean and sd, and
+// deques of increasing (decreasing) values give the min (max).
+//
+// Values have to be added in time order; a value older than the last one
+// starts the window over.
+class rolling_window
+{
+private:
+  struct sample
+  {
+    minutes_t minutes;
+    unsigned short value;
+
+    sample(minutes_t m, unsigned short v) : minutes(m), value(v) {}
+  };
+
+  minutes_t width_;
+  std::deque<sample> window_, mins_, maxs_;
+  boost::uint64_t sum_, sum2_;
+
+public:
+  explicit rolling_window(minutes_t width);
+
+  minutes_t width() const { return width_; }
+
+  // Add a value, and get the statistics of the window ending with it.
+  rolling_stats add(minutes_t minutes, unsigned short value);
+
+  void clear();
+};
+
+} // namespace contourpp
+
+#endif // CONTOURPP_ROLLING_H__
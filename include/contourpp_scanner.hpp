@@ -0,0 +1,44 @@
+#ifndef CONTOURPP_SCANNER_H__
+#define CONTOURPP_SCANNER_H__
+
+#include <cstddef>
+#include <vector>
+
+namespace contourpp
+{
+
+// Stage-one structural scanner: locates every occurrence of a small set of
+// characters (field separators, newlines, ...) in a buffer in a single pass,
+// 32 (AVX2) or 16 (SSE2) bytes at a time, and records their offsets.
+// Consumers split lines and fields by walking the offsets instead of
+// searching the text again.
+class structural_index
+{
+public:
+  static const size_t max_chars = 4;
+
+private:
+  std::vector<unsigned int> offsets_;
+  size_t count_;
+  char chars_[max_chars];
+  size_t nchars_;
+
+public:
+  structural_index() : count_(0), nchars_(0) {}
+
+  // Set the characters to look for: up to max_chars, NUL-terminated.
+  void set_chars(const char* chars);
+
+  // Index [b, e). Offsets are relative to b, so a block must not be larger
+  // than 4GB.
+  void scan(const char* b, const char* e);
+
+  void clear() { count_ = 0; }
+  size_t size() const { return count_; }
+  const unsigned int* begin() const { return offsets_.data(); }
+  const unsigned int* end() const { return offsets_.data() + count_; }
+};
+
+} // namespace contourpp
+
+#endif // CONTOURPP_SCANNER_H__
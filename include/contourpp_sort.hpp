@@ -0,0 +1,198 @@
+#ifndef CONTOURPP_SORT_H__
+#define CONTOURPP_SORT_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include "contourpp_driver.hpp"
+#include "contourpp_parallel.hpp"
+#include "contourpp_record_table.hpp"
+
+namespace contourpp
+{
+
+// The order of records by time, then index, as one unsigned integer.
+inline boost::uint64_t sort_key(minutes_t minutes, boost::uint32_t index)
+{
+  return (boost::uint64_t(boost::uint32_t(minutes) ^ 0x80000000U) << 32) | index;
+}
+
+// A hash of the time and index of a record and of other fields packed into
+// extra (e.g. the id of its meter), for open-addressing hash tables.
+inline size_t record_hash(minutes_t minutes, boost::uint32_t index, boost::uint64_t extra)
+{
+  boost::uint64_t h = sort_key(minutes, index) ^ (extra * 0x9E3779B97F4A7C15ULL);
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  return static_cast<size_t>(h);
+}
+
+// A row of a table with a key to radix sort it by, e.g. its sort_key().
+struct keyed_row
+{
+  boost::uint64_t key;
+  record_table::row_t row;
+};
+
+struct keyed_row_key
+{
+  boost::uint64_t operator()(const keyed_row& x) const { return x.key; }
+};
+
+namespace detail
+{
+
+// One pass of radix_sort() over parts of the input: count the digits of
+// each part, then (after the counts are turned into offsets) move each part
+// to its place.
+template <typename T, typename Key>
+struct radix_pass
+{
+  const T* in_;
+  T* out_;
+  size_t n_, parts_;
+  const Key& key_;
+  unsigned shift_;
+  std::vector<size_t>& counts_; // 256 per part
+  bool scatter_;
+
+  radix_pass(const T* in, T* out, size_t n, size_t parts, const Key& key, unsigned shift,
+    std::vector<size_t>& counts, bool scatter)
+    : in_(in), out_(out), n_(n), parts_(parts), key_(key), shift_(shift), counts_(counts),
+      scatter_(scatter) {}
+
+  void operator()(size_t p)
+  {
+    const T* b = in_ + (n_ * p) / parts_;
+    const T* e = in_ + (n_ * (p + 1)) / parts_;
+    size_t* c = &counts_[p * 256];
+
+    if (!scatter_) {
+      std::fill(c, c + 256, 0);
+      for (; b != e; ++b)
+        ++c[(key_(*b) >> shift_) & 0xFF];
+    }
+    else
+      for (; b != e; ++b)
+        out_[c[(key_(*b) >> shift_) & 0xFF]++] = *b;
+  }
+};
+
+} // namespace detail
+
+// Sort [b, e) stably by key(x), a boost::uint64_t, with an LSD radix sort of
+// a byte per pass, skipping the bytes that are the same in every key. tmp
+// has room for e - b elements. Large inputs are sorted in parts on up to
+// jobs threads.
+template <typename T, typename Key>
+void radix_sort(T* b, T* e, T* tmp, const Key& key, size_t jobs = 1)
+{
+  static const size_t min_part_size = 1 << 16;
+  const size_t n = e - b;
+  if (n < 2)
+    return;
+
+  // Bits that differ between keys.
+  boost::uint64_t all = ~boost::uint64_t(0), any = 0;
+  for (const T* p = b; p != e; ++p) {
+    all &= key(*p);
+    any |= key(*p);
+  }
+
+  const size_t parts = std::max<size_t>(1, std::min(jobs, n / min_part_size));
+  std::vector<size_t> counts(parts * 256);
+  T *in = b, *out = tmp;
+
+  for (unsigned shift = 0; shift < 64; shift += 8) {
+    if ((((all ^ any) >> shift) & 0xFF) == 0)
+      continue;
+
+    detail::radix_pass<T, Key> count(in, out, n, parts, key, shift, counts, false);
+    parallel_for(parts, jobs, count);
+
+    // Offsets by digit, then by part.
+    size_t offset = 0;
+    for (size_t d = 0; d < 256; ++d)
+      for (size_t p = 0; p < parts; ++p) {
+        const size_t c = counts[p * 256 + d];
+        counts[p * 256 + d] = offset;
+        offset += c;
+      }
+
+    detail::radix_pass<T, Key> scatter(in, out, n, parts, key, shift, counts, true);
+    parallel_for(parts, jobs, scatter);
+    std::swap(in, out);
+  }
+
+  if (in != b)
+    std::copy(in, in + n, b);
+}
+
+// Sorts records by time, then index, in bounded memory: the records are
+// gathered into runs of up to the given number of bytes, and each full run
+// is radix sorted and spilled to a temporary file (as raw entries, which are
+// read back in the same process). replay() then merges the runs, up to
+// max_fan_in at a time: while there are more, groups of them are merged
+// into longer runs in a new temporary file. The buffers of the merges also
+// fit in the memory.
+class record_sorter : public record_visitor
+{
+public:
+  static const size_t default_memory = 256 << 20;
+  static const size_t max_fan_in = 16;
+
+  // A record and the meter it comes from.
+  struct entry
+  {
+    record rec;
+    boost::uint32_t meter;
+  };
+
+  // A sorted run of a temporary file.
+  struct run
+  {
+    std::fpos_t start;
+    size_t size;
+  };
+
+private:
+  size_t capacity_;   // entries per run
+  size_t batch_size_; // entries read from each run at a time
+  size_t jobs_;
+  std::vector<entry> run_, tmp_;
+  std::FILE* file_;   // the spilled runs, one after another
+  std::vector<run> runs_;
+  std::vector<meter_info> meters_;
+  boost::uint32_t meter_;
+
+  void sort_run();
+  void save_run();
+  void merge_runs(size_t b, size_t e, record_visitor& visitor);
+  void merge_pass();
+
+  // Copy not allowed
+  record_sorter(const record_sorter&);
+  record_sorter & operator=(const record_sorter&);
+
+public:
+  explicit record_sorter(size_t memory = default_memory, size_t jobs = 1);
+  ~record_sorter();
+
+  void visit(const record* b, const record* e);
+  void header(const meter_info& info);
+
+  // Number of runs spilled so far.
+  size_t spilled_runs() const { return runs_.size(); }
+
+  // Pass the records to visitor in order, calling visitor.header() whenever
+  // the meter changes. Throws std::runtime_error if a temporary file can't
+  // be written or read back.
+  void replay(record_visitor& visitor);
+};
+
+} // namespace contourpp
+
+#endif // CONTOURPP_SORT_H__
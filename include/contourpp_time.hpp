@@ -0,0 +1,105 @@
+#ifndef CONTOURPP_TIME_H__
+#define CONTOURPP_TIME_H__
+
+#include <cstdio>
+#include <boost/cstdint.hpp>
+#include <boost/date_time.hpp>
+
+namespace contourpp
+{
+
+// Timestamps are kept as minutes since 1970-01-01 00:00 (meter local time),
+// which covers the years 1400 (the first year Boost.Date_Time supports) to
+// 6053 in 32 bits.
+typedef boost::int32_t minutes_t;
+
+static const minutes_t minutes_per_day = 24 * 60;
+
+inline bool is_leap_year(long y)
+{
+  return ((y % 4) == 0) && (((y % 100) != 0) || ((y % 400) == 0));
+}
+
+inline unsigned last_day_of_month(long y, unsigned m)
+{
+  static const unsigned char days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  return ((m == 2) && is_leap_year(y))? 29 : days[m - 1];
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date (Howard Hinnant's
+// days_from_civil algorithm).
+inline long days_from_civil(long y, unsigned m, unsigned d)
+{
+  y -= (m <= 2);
+  const long era = ((y >= 0)? y : (y - 399)) / 400;
+  const unsigned yoe = static_cast<unsigned>(y - era * 400);
+  const unsigned doy = (153 * ((m > 2)? (m - 3) : (m + 9)) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + static_cast<long>(doe) - 719468;
+}
+
+// Inverse of days_from_civil().
+inline void civil_from_days(long z, long& y, unsigned& m, unsigned& d)
+{
+  z += 719468;
+  const long era = ((z >= 0)? z : (z - 146096)) / 146097;
+  const unsigned doe = static_cast<unsigned>(z - era * 146097);
+  const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const unsigned mp = (5 * doy + 2) / 153;
+  d = doy - (153 * mp + 2) / 5 + 1;
+  m = (mp < 10)? (mp + 3) : (mp - 9);
+  y = static_cast<long>(yoe) + era * 400 + (m <= 2);
+}
+
+// Floor division, for splitting (possibly negative) minutes into days.
+inline long floor_div(long a, long b)
+{
+  return (a >= 0)? (a / b) : -((b - 1 - a) / b);
+}
+
+inline boost::posix_time::ptime to_ptime(minutes_t m)
+{
+  return boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1),
+    boost::posix_time::minutes(m));
+}
+
+inline minutes_t to_minutes(const boost::posix_time::ptime& t)
+{
+  const boost::posix_time::time_duration d =
+    t - boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1));
+  return static_cast<minutes_t>(floor_div(d.total_seconds(), 60));
+}
+
+// Parse a date ("YYYY-MM-DD") or a time ("YYYY-MM-DD HH:MM", or with a 'T'
+// instead of the space). Sets m to its first minute and span to the minutes
+// it covers: a day for a date, one for a time.
+inline bool parse_minutes(const char* s, minutes_t& m, minutes_t& span)
+{
+  long y = 0;
+  unsigned mo = 0, d = 0, h = 0, mi = 0;
+  int n = 0;
+
+  if ((std::sscanf(s, "%4ld-%2u-%2u%n", &y, &mo, &d, &n) != 3) || (n != 10))
+    return false;
+  if ((y < 1400) || (y > 6053) || (mo < 1) || (mo > 12) || (d < 1) ||
+      (d > last_day_of_month(y, mo)))
+    return false;
+
+  span = minutes_per_day;
+  s += n;
+  if (*s) {
+    if (((*s != ' ') && (*s != 'T')) ||
+        (std::sscanf(s + 1, "%2u:%2u%n", &h, &mi, &n) != 2) || (n != 5) ||
+        s[6] || (h > 23) || (mi > 59))
+      return false;
+    span = 1;
+  }
+
+  m = static_cast<minutes_t>(days_from_civil(y, mo, d) * minutes_per_day + h * 60 + mi);
+  return true;
+}
+
+} // namespace contourpp
+
+#endif // CONTOURPP_TIME_H__
@@ -0,0 +1,100 @@
+#ifndef CONTOURPP_TIMEZONE_H__
+#define CONTOURPP_TIMEZONE_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "contourpp_time.hpp"
+
+namespace contourpp
+{
+
+// A zone of the IANA time zone database, as a table of the UTC offsets it has
+// had (and, by its rules, will have until last_year), in minutes.
+class time_zone
+{
+public:
+  static const long last_year = 6053; // the last year of minutes_t
+
+  // Looks up the offsets of times that mostly come in order: the interval of
+  // the last lookup is kept, so that the next one is usually a single range
+  // check, and otherwise a step to the following interval or a binary search.
+  class cursor
+  {
+  private:
+    const time_zone& zone_;
+    size_t i_;
+    minutes_t begin_, end_, offset_; // offset_ holds in [begin_, end_)
+
+    void seek(minutes_t utc);
+
+  public:
+    explicit cursor(const time_zone& zone);
+
+    minutes_t offset(minutes_t utc) {
+      if ((utc < begin_) || (utc >= end_))
+        seek(utc);
+      return offset_;
+    }
+
+    // The UTC time of a local time. Times skipped or repeated by a
+    // transition are taken with the offset before it.
+    minutes_t to_utc(minutes_t local);
+  };
+
+  // UTC.
+  time_zone();
+
+  // Load a zone, e.g. "Europe/Athens", from the tzdata files (in $TZDIR, or
+  // /usr/share/zoneinfo). Throws std::runtime_error if it can't be read.
+  explicit time_zone(const std::string& name);
+
+  const std::string& name() const { return name_; }
+
+  // The offset from UTC at the UTC time utc.
+  minutes_t offset(minutes_t utc) const;
+
+  minutes_t min_offset() const;
+  minutes_t max_offset() const;
+
+private:
+  std::string name_;
+  // offsets_[i] holds from starts_[i] until starts_[i + 1]; starts_[0] is the
+  // earliest time there is.
+  std::vector<minutes_t> starts_, offsets_;
+
+  void add(minutes_t start, minutes_t offset);
+  void add_rules(const std::string& tz, minutes_t after);
+};
+
+// Converts times from the local time of one zone to that of another, e.g.
+// from the UTC clock of a meter to the local time where the readings were
+// taken. Fast for times that mostly come in order.
+class zone_converter
+{
+private:
+  time_zone from_, to_;
+  time_zone::cursor from_cursor_, to_cursor_;
+
+  // Copy not allowed
+  zone_converter(const zone_converter&);
+  zone_converter & operator=(const zone_converter&);
+
+public:
+  zone_converter(const time_zone& from, const time_zone& to);
+
+  minutes_t convert(minutes_t m) {
+    const minutes_t utc = from_cursor_.to_utc(m);
+    return utc + to_cursor_.offset(utc);
+  }
+
+  // Convert the times in [b, e) in place, except for record::no_minutes.
+  void convert(minutes_t* b, minutes_t* e);
+
+  // The most that a time can be moved, either way.
+  minutes_t max_shift() const;
+};
+
+} // namespace contourpp
+
+#endif // CONTOURPP_TIMEZONE_H__
@@ -1,11 +1,29 @@
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <iterator>
-#include <fstream>
+#include <limits>
 #include <exception>
 #include <string>
 #include <vector>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 #include "hid_commands.hpp"
+#include "contourpp_aggregate.hpp"
+#include "contourpp_archive.hpp"
+#include "contourpp_dedup.hpp"
+#include "contourpp_diff.hpp"
 #include "contourpp_driver.hpp"
+#include "contourpp_formatter.hpp"
+#include "contourpp_mapped_file.hpp"
+#include "contourpp_merge.hpp"
+#include "contourpp_parallel.hpp"
+#include "contourpp_predicate.hpp"
+#include "contourpp_record_table.hpp"
+#include "contourpp_rolling.hpp"
+#include "contourpp_sort.hpp"
+#include "contourpp_timezone.hpp"
 #include "contourpp_optionparser.hpp"
 
 static void lowLevelAPI()
@@ -23,63 +41,539 @@ static void lowLevelAPI()
   }
 }
 
-static unsigned char getRecordType(const contourpp::record& rec)
+// Range of the entries to print, in minutes since 1970 (both ends included).
+struct TimeRange
 {
-  if (rec.is_glucose()) return rec.min_after_meal()? 17 : 1;
-  if (rec.is_insulin_short()) return 2;
-  if (rec.is_insulin_long()) return 4;
-  if (rec.is_carbs()) return 8;
-  return 128;
+  contourpp::minutes_t from, to;
+
+  TimeRange()
+    : from(std::numeric_limits<contourpp::minutes_t>::min()),
+      to(std::numeric_limits<contourpp::minutes_t>::max()) {}
+
+  bool all() const { return *this == TimeRange(); }
+  bool contains(contourpp::minutes_t m) const { return (m >= from) && (m <= to); }
+  bool operator==(const TimeRange& o) const { return (from == o.from) && (to == o.to); }
+
+  // The range of the times before shifting them by shift minutes.
+  TimeRange unshifted(long shift) const
+  {
+    TimeRange r;
+    if (from != r.from)
+      r.from = clamp(static_cast<long long>(from) - shift);
+    if (to != r.to)
+      r.to = clamp(static_cast<long long>(to) - shift);
+    return r;
+  }
+
+  // The range widened by m minutes either way.
+  TimeRange widened(long m) const
+  {
+    TimeRange r;
+    if (from != r.from)
+      r.from = clamp(static_cast<long long>(from) - m);
+    if (to != r.to)
+      r.to = clamp(static_cast<long long>(to) + m);
+    return r;
+  }
+
+  static contourpp::minutes_t clamp(long long m)
+  {
+    return static_cast<contourpp::minutes_t>(std::max<long long>(
+      std::numeric_limits<contourpp::minutes_t>::min(),
+      std::min<long long>(m, std::numeric_limits<contourpp::minutes_t>::max())));
+  }
+};
+
+// Reads an archive, only decoding the blocks in range.
+static void readArchive(const contourpp::mapped_file& file, const TimeRange& range,
+  contourpp::record_visitor& visitor)
+{
+  contourpp::archive_reader reader(file.begin(), file.end());
+  reader.read_range(range.from, range.to, visitor);
 }
 
-static void highLevelAPI(std::vector<const char*> const& filenames,
-  bool print_bayer_format, const boost::posix_time::time_duration& d,
-  unsigned char recordfilter)
+enum InputFormat { INPUT_AUTO, INPUT_BAYER, INPUT_CSV, INPUT_ARCHIVE };
+
+// The format of the input [b, e), when it is to be detected.
+static InputFormat detectFormat(InputFormat format, const char* b, const char* e)
+{
+  if (format != INPUT_AUTO)
+    return format;
+  if (contourpp::archive_reader::is_archive(b, e))
+    return INPUT_ARCHIVE;
+  return contourpp::record_parser::is_csv(b, e)? INPUT_CSV : INPUT_BAYER;
+}
+
+// Parses each input file with its own record_parser; safe to run on
+// several files at once.
+struct FileParser
 {
-  contourpp::record_parser parser;
-  std::vector<contourpp::record> records;
+  const std::vector<const char*>& filenames_;
+  std::vector<contourpp::record_table>& results_;
+  size_t jobs_;
+  TimeRange range_;
+  InputFormat format_;
 
-  records.reserve(128);
+  FileParser(const std::vector<const char*>& filenames,
+    std::vector<contourpp::record_table>& results, size_t jobs, const TimeRange& range,
+    InputFormat format)
+    : filenames_(filenames), results_(results), jobs_(jobs), range_(range),
+      format_(format) {}
 
-  if (!filenames.empty()) {
-    for (std::vector<const char*>::const_iterator f = filenames.begin(); f != filenames.end(); ++f) {
-      std::ifstream ifs(*f);
-      if (!ifs.good())
-        throw std::runtime_error(std::string("could not open '") + (*f) + "'");
-
-      std::string buf;
-      contourpp::record rec;
-      while (std::getline(ifs, buf)) {
-        if (parser.parse(buf.data(), buf.data() + buf.size(), rec)) {
-          if (records.size() == records.capacity())
-            records.reserve(2 * records.capacity());
-          records.push_back(rec);
+  void operator()(size_t i)
+  {
+    contourpp::mapped_file file(filenames_[i]);
+    contourpp::record_parser parser;
+
+    switch (detectFormat(format_, file.begin(), file.end())) {
+      case INPUT_ARCHIVE:
+        if (range_.all()) {
+          contourpp::archive_reader reader(file.begin(), file.end());
+          reader.read_all(results_[i]);
         }
-      }
+        else
+          readArchive(file, range_, results_[i]);
+        break;
+      case INPUT_CSV:
+        parser.parse_all_csv(file.begin(), file.end(), results_[i], jobs_);
+        break;
+      default:
+        parser.parse_all(file.begin(), file.end(), results_[i], jobs_);
+    }
+  }
+};
+
+enum OutputFormat { FORMAT_CSV, FORMAT_BAYER, FORMAT_ARCHIVE, FORMAT_JSON };
+
+// Aggregates a range of the selected rows of a table, for parallel_for.
+struct RowAggregator
+{
+  const contourpp::record_table& table_;
+  const std::vector<contourpp::record_table::row_t>& rows_;
+  std::vector<contourpp::record_aggregator>& parts_;
+
+  RowAggregator(const contourpp::record_table& table,
+    const std::vector<contourpp::record_table::row_t>& rows,
+    std::vector<contourpp::record_aggregator>& parts)
+    : table_(table), rows_(rows), parts_(parts) {}
+
+  void operator()(size_t i)
+  {
+    const size_t n = parts_.size();
+    const contourpp::record_table::row_t* r = rows_.data();
+    parts_[i].add(table_, r + (rows_.size() * i) / n, r + (rows_.size() * (i + 1)) / n);
+  }
+};
+
+// Radix sorts the rows of a table by time, then index, on up to jobs threads.
+static void sortRows(const contourpp::record_table& table,
+  std::vector<contourpp::record_table::row_t>& rows, size_t jobs)
+{
+  const contourpp::minutes_t* minutes = table.minutes();
+  const boost::uint32_t* indices = table.indices();
+  std::vector<contourpp::keyed_row> keyed(rows.size()), tmp(rows.size());
+  for (size_t i = 0; i < rows.size(); ++i) {
+    keyed[i].key = contourpp::sort_key(minutes[rows[i]], indices[rows[i]]);
+    keyed[i].row = rows[i];
+  }
+  contourpp::radix_sort(keyed.data(), keyed.data() + keyed.size(), tmp.data(),
+    contourpp::keyed_row_key(), jobs);
+  for (size_t i = 0; i < rows.size(); ++i)
+    rows[i] = keyed[i].row;
+}
+
+// Shifts, filters and prints records. Used on the whole record set, or on
+// each batch of a streaming parse.
+class RecordPrinter : public contourpp::record_visitor
+{
+private:
+  OutputFormat format_;
+  boost::posix_time::time_duration d_;
+  unsigned char recordfilter_;
+  TimeRange range_;
+  const contourpp::record_predicate* where_;
+  contourpp::record_aggregator* aggregate_;
+  size_t jobs_;
+  contourpp::record_formatter text_;
+  contourpp::archive_writer archive_;
+  contourpp::zone_converter* zones_;
+  std::vector<contourpp::rolling_window> rolling_;
+  std::vector<contourpp::rolling_stats> stats_;
+  bool sorted_;
+  contourpp::record_set* dedup_;
+  contourpp::record_set::serial_t serial_;
+  char mark_;
+  bool prepared_;
+
+public:
+  // If aggregate is not NULL, the records are summarized into it instead of
+  // being printed.
+  RecordPrinter(OutputFormat format, const boost::posix_time::time_duration& d,
+    unsigned char recordfilter, const TimeRange& range,
+    const contourpp::record_predicate* where, contourpp::record_aggregator* aggregate,
+    size_t jobs)
+    : format_(format), d_(d), recordfilter_(recordfilter), range_(range), where_(where),
+      aggregate_(aggregate), jobs_(jobs), text_(std::cout), archive_(std::cout), zones_(NULL),
+      sorted_(false), dedup_(NULL), serial_(0), mark_(0), prepared_(false) {}
+
+  // Convert the times between time zones (after shifting them).
+  void setZones(contourpp::zone_converter* zones) { zones_ = zones; }
+
+  // Drop the records already in dedup, adding the others.
+  void setDedup(contourpp::record_set* dedup)
+  {
+    dedup_ = dedup;
+    if (dedup_)
+      serial_ = dedup_->serial_id(std::string());
+  }
+
+  // Start the lines of text with a field of mark (unless 0).
+  void setMark(char mark) { mark_ = mark; }
+
+  // Print the records of a table sorted by time, then index.
+  void setSorted(bool sorted) { sorted_ = sorted; }
+
+  // Append rolling statistics over windows of the given widths to the
+  // glucose entries.
+  void setRolling(const std::vector<contourpp::minutes_t>& widths)
+  {
+    rolling_.clear();
+    for (size_t i = 0; i < widths.size(); ++i)
+      rolling_.push_back(contourpp::rolling_window(widths[i]));
+    stats_.resize(widths.size());
+  }
+
+  // The range of the input records that may be printed.
+  TimeRange inputRange() const
+  {
+    long m = zones_? zones_->max_shift() : 0;
+    // The rolling windows also see the records before the range.
+    contourpp::minutes_t width = 0;
+    for (size_t i = 0; i < rolling_.size(); ++i)
+      width = std::max(width, rolling_[i].width());
+    m += width;
+    const TimeRange r = range_.unshifted(contourpp::floor_div(d_.total_seconds(), 60));
+    return m? r.widened(m) : r;
+  }
+
+  // Add a record to the rolling windows, keeping its statistics for print().
+  void roll(const contourpp::record& rec)
+  {
+    for (size_t i = 0; i < rolling_.size(); ++i)
+      stats_[i] = (rec.is_glucose() && (rec.minutes() != contourpp::record::no_minutes))?
+        rolling_[i].add(rec.minutes(), rec.value()) : contourpp::rolling_stats();
+  }
+
+  void print(const contourpp::record& rec)
+  {
+    if (aggregate_) {
+      aggregate_->add(rec);
+      return;
+    }
+
+    switch (format_) {
+      case FORMAT_BAYER:
+        if (mark_)
+          text_.bayer(mark_, rec);
+        else
+          text_.bayer(rec);
+        break;
+      case FORMAT_ARCHIVE:
+        archive_.visit(&rec, &rec + 1);
+        break;
+      default:
+        if (mark_) {
+          text_.csv(mark_, rec);
+          break;
+        }
+        if (rolling_.empty())
+          text_.csv(rec);
+        else
+          text_.csv(rec, stats_.data(), stats_.size());
     }
   }
-  else
-    parser.get_all(records);
 
-  std::vector<contourpp::record>::iterator i, e(records.end());
+  // Filter a record by type (and as a duplicate), then shift its time and
+  // convert it between time zones. Returns false if it is left out.
+  bool prepare(contourpp::record& rec)
+  {
+    if (!(rec.type() & recordfilter_))
+      return false;
+    if (dedup_ && !dedup_->insert(serial_, rec))
+      return false;
+
+    if (d_.total_seconds() != 0)
+      rec.shift_time(d_);
+    if (zones_ && (rec.minutes() != contourpp::record::no_minutes))
+      rec.shift_minutes(zones_->convert(rec.minutes()) - rec.minutes());
+    return true;
+  }
+
+  // The meter of the records passed to prepare() from now on.
+  void prepareMeter(const contourpp::meter_info& info)
+  {
+    if (dedup_)
+      serial_ = dedup_->serial_id(info.serial);
+  }
+
+  // Take the records visited as passed through prepare() already, e.g.
+  // before sorting them by the times printed.
+  void setPrepared(bool prepared) { prepared_ = prepared; }
+
+  void header(const contourpp::meter_info& info)
+  {
+    if (!prepared_)
+      prepareMeter(info);
+    if (format_ == FORMAT_ARCHIVE)
+      archive_.header(info);
+  }
+
+  void visit(const contourpp::record* b, const contourpp::record* e)
+  {
+    // The rolling windows see the records left out by the range and --where.
+    const bool rolling = !rolling_.empty();
+    std::vector<contourpp::record> records;
 
-  if (d.total_seconds() != 0) {
-    for (i = records.begin(); i != e; ++i)
-      i->shift_time(d);
+    for (; b != e; ++b) {
+      contourpp::record rec(*b);
+      if (!prepared_ && !prepare(rec))
+        continue;
+      if (rolling || range_.contains(rec.minutes()))
+        records.push_back(rec);
+    }
+
+    std::vector<unsigned char> match(records.size(), 1);
+    if (where_ && !records.empty())
+      where_->evaluate(records.data(), records.data() + records.size(), match.data());
+
+    for (size_t i = 0; i < records.size(); ++i) {
+      if (rolling)
+        roll(records[i]);
+      if (match[i] && range_.contains(records[i].minutes()))
+        print(records[i]);
+    }
   }
-  if (print_bayer_format) {
-    for (i = records.begin(); i != e; ++i) {
-      if (getRecordType(*i) & recordfilter) {
-        i->print_bayer(std::cout);
-        std::cout << std::endl;
+
+  // Shift and filter column-wise, then print the selected rows.
+  void visit(contourpp::record_table& table)
+  {
+    std::vector<contourpp::record_table::row_t> rows;
+    table.select(recordfilter_, rows);
+    if (dedup_)
+      dedup_->filter(table, rows);
+
+    if (d_.total_seconds() != 0)
+      table.shift_minutes(static_cast<contourpp::minutes_t>(
+        contourpp::floor_div(d_.total_seconds(), 60)));
+    if (zones_)
+      zones_->convert(table.minutes(), table.minutes() + table.size());
+
+    // The rolling windows see all the rows, in the order printed, so keep
+    // them (sorted) from before the range and --where.
+    std::vector<contourpp::record_table::row_t> all;
+    if (!rolling_.empty()) {
+      if (sorted_)
+        sortRows(table, rows, jobs_);
+      all = rows;
+    }
+
+    if (where_)
+      where_->filter(table, rows);
+
+    if (!range_.all()) {
+      const contourpp::minutes_t* minutes = table.minutes();
+      size_t n = 0;
+      for (size_t i = 0; i < rows.size(); ++i)
+        if (range_.contains(minutes[rows[i]]))
+          rows[n++] = rows[i];
+      rows.resize(n);
+    }
+
+    if (sorted_ && !aggregate_ && rolling_.empty())
+      sortRows(table, rows, jobs_);
+
+    if (aggregate_) {
+      // Summarize parts of the rows on separate threads, then merge them.
+      static const size_t min_part_size = 1 << 16;
+      const size_t nparts = std::max<size_t>(1, std::min(jobs_, rows.size() / min_part_size));
+      std::vector<contourpp::record_aggregator> parts(nparts, *aggregate_);
+      RowAggregator rowaggregator(table, rows, parts);
+      contourpp::parallel_for(nparts, jobs_, rowaggregator);
+      for (size_t i = 0; i < nparts; ++i)
+        aggregate_->merge(parts[i]);
+      return;
+    }
+
+    const contourpp::record_table::meter_t* meter_ids = table.meter_ids();
+    contourpp::record_table::meter_t meter = 0;
+    size_t next = 0;
+    for (size_t i = 0; i < rows.size(); ++i) {
+      if (meter_ids[rows[i]] != meter)
+        header(table.meters()[meter = meter_ids[rows[i]]]);
+      // Roll the windows on up to this row (the filters keep the order).
+      while (next < all.size()) {
+        const contourpp::record_table::row_t row = all[next++];
+        roll(table[row]);
+        if (row == rows[i])
+          break;
       }
+      print(table[rows[i]]);
+    }
+  }
+
+  // Write out what is still buffered.
+  void finish()
+  {
+    if (aggregate_)
+      aggregate_->print(std::cout, format_ == FORMAT_JSON);
+    if (format_ == FORMAT_ARCHIVE)
+      archive_.end_segment();
+    text_.flush();
+  }
+};
+
+// Passes the records through RecordPrinter::prepare() on to another visitor,
+// e.g. a sort, so that it gets the times that will be printed.
+class RecordPreparer : public contourpp::record_visitor
+{
+private:
+  RecordPrinter& printer_;
+  contourpp::record_visitor& next_;
+  std::vector<contourpp::record> records_;
+
+public:
+  RecordPreparer(RecordPrinter& printer, contourpp::record_visitor& next)
+    : printer_(printer), next_(next) {}
+
+  void header(const contourpp::meter_info& info)
+  {
+    printer_.prepareMeter(info);
+    next_.header(info);
+  }
+
+  void visit(const contourpp::record* b, const contourpp::record* e)
+  {
+    records_.clear();
+    for (; b != e; ++b) {
+      records_.push_back(*b);
+      if (!printer_.prepare(records_.back()))
+        records_.pop_back();
+    }
+    if (!records_.empty())
+      next_.visit(records_.data(), records_.data() + records_.size());
+  }
+};
+
+// Parse and print the input one batch at a time, in constant memory.
+static void streamingAPI(std::vector<const char*> const& filenames,
+  contourpp::record_visitor& printer, const TimeRange& range, InputFormat format)
+{
+  if (filenames.empty()) {
+    contourpp::record_parser parser;
+    parser.get_all(printer);
+    return;
+  }
+
+  for (std::vector<const char*>::const_iterator f = filenames.begin(); f != filenames.end(); ++f) {
+    contourpp::record_parser parser;
+    if (((*f)[0] == '-') && ((*f)[1] == 0)) {
+      const char c = static_cast<char>(std::cin.peek());
+      if (detectFormat(format, &c, &c + 1) == INPUT_CSV)
+        parser.get_all_csv(std::cin, printer);
+      else
+        parser.get_all(std::cin, printer);
+      continue;
+    }
+
+    contourpp::mapped_file file(*f);
+    switch (detectFormat(format, file.begin(), file.end())) {
+      case INPUT_ARCHIVE:
+        readArchive(file, range, printer);
+        break;
+      case INPUT_CSV:
+        parser.parse_all_csv(file.begin(), file.end(), printer);
+        break;
+      default:
+        parser.parse_all(file.begin(), file.end(), printer);
+    }
+  }
+}
+
+// Merge the records of the inputs in time order, a batch of each at a time.
+static void mergeAPI(std::vector<const char*> const& filenames,
+  contourpp::record_visitor& printer, InputFormat format)
+{
+  const size_t n = filenames.size();
+  boost::scoped_array<contourpp::mapped_file> files(new contourpp::mapped_file[n]);
+  std::vector<boost::shared_ptr<contourpp::record_source> > sources;
+
+  for (size_t i = 0; i < n; ++i) {
+    files[i].open(filenames[i]);
+    const char *b = files[i].begin(), *e = files[i].end();
+    const InputFormat f = detectFormat(format, b, e);
+    if (f == INPUT_ARCHIVE)
+      sources.push_back(boost::shared_ptr<contourpp::record_source>(
+        new contourpp::archive_source(b, e)));
+    else
+      sources.push_back(boost::shared_ptr<contourpp::record_source>(
+        new contourpp::text_source(b, e, f == INPUT_CSV)));
+  }
+
+  std::vector<contourpp::record_source*> inputs;
+  for (size_t i = 0; i < n; ++i)
+    inputs.push_back(sources[i].get());
+  contourpp::merge_records(inputs, printer);
+}
+
+// Print the records of the first input that are not in the second, marked
+// "-", then those of the second that are not in the first, marked "+".
+static void diffAPI(std::vector<const char*> const& filenames,
+  RecordPrinter& printer, size_t jobs, InputFormat format)
+{
+  std::vector<contourpp::record_table> results(2);
+  FileParser fileparser(filenames, results, std::max<size_t>(1, jobs / 2), printer.inputRange(),
+    format);
+  contourpp::parallel_for(2, jobs, fileparser);
+
+  contourpp::record_table only_a, only_b;
+  contourpp::diff_tables(results[0], results[1], only_a, only_b, jobs);
+  results.clear();
+
+  printer.setMark('-');
+  printer.visit(only_a);
+  printer.setMark('+');
+  printer.visit(only_b);
+}
+
+static void highLevelAPI(std::vector<const char*> const& filenames,
+  RecordPrinter& printer, size_t jobs, InputFormat format)
+{
+  contourpp::record_table table;
+
+  if (!filenames.empty()) {
+    // Parse the files concurrently (and large files in chunks), then
+    // concatenate them in command line order.
+    std::vector<contourpp::record_table> results(filenames.size());
+    FileParser fileparser(filenames, results, std::max<size_t>(1, jobs / filenames.size()),
+      printer.inputRange(), format);
+    contourpp::parallel_for(filenames.size(), jobs, fileparser);
+
+    size_t total = 0;
+    for (size_t i = 0; i < results.size(); ++i)
+      total += results[i].size();
+
+    table.reserve(total);
+    for (size_t i = 0; i < results.size(); ++i) {
+      table.append(results[i]);
+      results[i] = contourpp::record_table();
     }
   }
   else {
-    for (i = records.begin(); i != e; ++i)
-      if (getRecordType(*i) & recordfilter)
-        std::cout << (*i) << std::endl;
+    contourpp::record_parser parser;
+    parser.get_all(table);
   }
+
+  printer.visit(table);
 }
 
 int main(int argc, char* argv[])
@@ -122,6 +616,31 @@ int main(int argc, char* argv[])
   for (int i = 0; i < optionparser.nonOptionsCount(); i++)
     filenames.push_back(optionparser.nonOption(i));
 
+  size_t jobs = contourpp::default_jobs();
+  for (const option::Option* opt = options[JOBS]; opt; opt = opt->next())
+    jobs = strtol(opt->arg, NULL, 10);
+
+  TimeRange range;
+  contourpp::minutes_t span;
+  for (const option::Option* opt = options[FROM]; opt; opt = opt->next())
+    contourpp::parse_minutes(opt->arg, range.from, span);
+  for (const option::Option* opt = options[TO]; opt; opt = opt->next()) {
+    contourpp::parse_minutes(opt->arg, range.to, span);
+    range.to = TimeRange::clamp(static_cast<long long>(range.to) + span - 1);
+  }
+
+  InputFormat inputformat = INPUT_AUTO;
+  for (const option::Option* opt = options[INPUTFORMAT]; opt; opt = opt->next())
+    inputformat = !strcmp(opt->arg, "bayer")? INPUT_BAYER :
+      !strcmp(opt->arg, "csv")? INPUT_CSV :
+      !strcmp(opt->arg, "archive")? INPUT_ARCHIVE : INPUT_AUTO;
+
+  OutputFormat format = options[OLDFORMAT]? FORMAT_BAYER : FORMAT_CSV;
+  for (const option::Option* opt = options[OUTPUTFORMAT]; opt; opt = opt->next())
+    format = !strcmp(opt->arg, "archive")? FORMAT_ARCHIVE :
+      !strcmp(opt->arg, "bayer")? FORMAT_BAYER :
+      !strcmp(opt->arg, "json")? FORMAT_JSON : FORMAT_CSV;
+
   boost::posix_time::time_duration d(0, 0, 0, 0);
   for (const option::Option* opt = options[TIMESHIFT]; opt; opt = opt->next())
     d += boost::posix_time::duration_from_string(opt->arg);
@@ -129,8 +648,105 @@ int main(int argc, char* argv[])
   try {
     if (options[LOWLEVEL])
       lowLevelAPI();
-    else
-      highLevelAPI(filenames, options[OLDFORMAT], d, recordfilter);
+    else {
+      boost::scoped_ptr<contourpp::record_predicate> where;
+      for (const option::Option* opt = options[WHERE]; opt; opt = opt->next())
+        where.reset(new contourpp::record_predicate(opt->arg));
+
+      boost::scoped_ptr<contourpp::record_aggregator> aggregate;
+      for (const option::Option* opt = options[AGGREGATE]; opt; opt = opt->next())
+        aggregate.reset(new contourpp::record_aggregator(
+          !strcmp(opt->arg, "day")? contourpp::record_aggregator::by_day :
+          !strcmp(opt->arg, "hour")? contourpp::record_aggregator::by_hour :
+          !strcmp(opt->arg, "slot")? contourpp::record_aggregator::by_slot :
+          !strcmp(opt->arg, "weekday")? contourpp::record_aggregator::by_weekday :
+          !strcmp(opt->arg, "tag")? contourpp::record_aggregator::by_tag :
+          contourpp::record_aggregator::by_all));
+
+      if (options[AGP] && !aggregate)
+        aggregate.reset(new contourpp::record_aggregator(contourpp::record_aggregator::by_slot));
+
+      if (options[PERCENTILES] || options[AGP]) {
+        static const double quartiles[] = { 25, 50, 75 };
+        static const double agp[] = { 5, 25, 50, 75, 95 };
+        std::vector<double> percentiles(quartiles, quartiles + 3);
+        if (options[AGP])
+          percentiles.assign(agp, agp + 5);
+        for (const option::Option* opt = options[PERCENTILES]; opt; opt = opt->next())
+          if (opt->arg)
+            Arg::parsePercentiles(opt->arg, percentiles);
+
+        if (!aggregate)
+          aggregate.reset(new contourpp::record_aggregator(contourpp::record_aggregator::by_all));
+        aggregate->set_percentiles(percentiles);
+      }
+
+      if ((format == FORMAT_JSON) && !aggregate)
+        throw std::runtime_error("json output is only for --aggregate, --percentiles and --agp");
+
+      std::vector<contourpp::minutes_t> windows;
+      for (const option::Option* opt = options[ROLLING]; opt; opt = opt->next())
+        Arg::parseWindows(opt->arg, windows);
+      if (!windows.empty() && (aggregate || (format != FORMAT_CSV)))
+        throw std::runtime_error("--rolling is only for csv output of the entries");
+
+      if (options[DIFF]) {
+        if (filenames.size() != 2)
+          throw std::runtime_error("--diff needs two input files");
+        if (aggregate || !windows.empty() || ((format != FORMAT_CSV) && (format != FORMAT_BAYER)))
+          throw std::runtime_error("--diff is only for csv and bayer output of the entries");
+      }
+
+      boost::scoped_ptr<contourpp::zone_converter> zones;
+      if (options[TIMEZONE] || options[METERTIMEZONE]) {
+        contourpp::time_zone from, to;
+        for (const option::Option* opt = options[METERTIMEZONE]; opt; opt = opt->next())
+          from = contourpp::time_zone(opt->arg);
+        for (const option::Option* opt = options[TIMEZONE]; opt; opt = opt->next())
+          to = contourpp::time_zone(opt->arg);
+        zones.reset(new contourpp::zone_converter(from, to));
+      }
+
+      RecordPrinter printer(format, d, recordfilter, range, where.get(), aggregate.get(), jobs);
+      printer.setRolling(windows);
+      printer.setZones(zones.get());
+      contourpp::record_set dedup;
+      if (options[DEDUP])
+        printer.setDedup(&dedup);
+      if (options[DIFF]) {
+        printer.setSorted(options[SORT] != NULL);
+        diffAPI(filenames, printer, jobs, inputformat);
+      }
+      else if (options[SORT] && (options[STREAM] || options[MERGE] || options[SORTMEMORY])) {
+        // Sort what would be read in streaming (or merge) mode.
+        size_t memory = contourpp::record_sorter::default_memory;
+        for (const option::Option* opt = options[SORTMEMORY]; opt; opt = opt->next()) {
+          const size_t mib = static_cast<size_t>(strtol(opt->arg, NULL, 10));
+          if (mib > (~size_t(0) >> 20))
+            throw std::runtime_error("--sort-memory is too large");
+          memory = mib << 20;
+        }
+
+        // Sort by the times printed, as without --sort-memory.
+        contourpp::record_sorter sorter(memory, jobs);
+        RecordPreparer preparer(printer, sorter);
+        if (options[MERGE] && !filenames.empty())
+          mergeAPI(filenames, preparer, inputformat);
+        else
+          streamingAPI(filenames, preparer, printer.inputRange(), inputformat);
+        printer.setPrepared(true);
+        sorter.replay(printer);
+      }
+      else if (options[MERGE] && !filenames.empty())
+        mergeAPI(filenames, printer, inputformat);
+      else if (options[STREAM])
+        streamingAPI(filenames, printer, printer.inputRange(), inputformat);
+      else {
+        printer.setSorted(options[SORT] != NULL);
+        highLevelAPI(filenames, printer, jobs, inputformat);
+      }
+      printer.finish();
+    }
   } catch(const std::runtime_error& e) {
     std::cerr << e.what() << std::endl;
     return -1;
@@ -0,0 +1,269 @@
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include "contourpp_aggregate.hpp"
+
+using namespace contourpp;
+
+// The names of the groupings, by grouping_t.
+static const char* const grouping_names[] = {
+  "day", "hour", "weekday", "tag", "all", "slot"
+};
+
+static const char* const weekday_names[] = {
+  "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+
+// Glucose tags in the order of their bits, then after meal and untagged
+// readings.
+static const char* const tag_names[] = {
+  "control", "before_food", "after_food", "dont_feel_right", "sick", "stress",
+  "activity", "after_meal", "none"
+};
+
+static const size_t tag_after_meal = 7, tag_none = 8;
+
+void glucose_histogram::merge(const glucose_histogram& o)
+{
+  for (size_t i = 0; i < bins; ++i)
+    counts_[i] += o.counts_[i];
+  for (std::map<unsigned short, boost::uint64_t>::const_iterator v = o.overflow_.begin();
+       v != o.overflow_.end(); ++v)
+    overflow_[v->first] += v->second;
+  count_ += o.count_;
+}
+
+unsigned short glucose_histogram::quantile(double q) const
+{
+  if (!count_)
+    return 0;
+
+  const double r = std::ceil(q * count_ - 1e-9);
+  const boost::uint64_t rank = (r < 1)? 1 : static_cast<boost::uint64_t>(r);
+
+  boost::uint64_t seen = 0;
+  for (size_t i = 0; i < bins; ++i)
+    if ((seen += counts_[i]) >= rank)
+      return static_cast<unsigned short>(i);
+
+  std::map<unsigned short, boost::uint64_t>::const_iterator v = overflow_.begin();
+  for (; v != overflow_.end(); ++v)
+    if ((seen += v->second) >= rank)
+      return v->first;
+  return overflow_.rbegin()->first;
+}
+
+record_aggregator::record_aggregator(grouping_t grouping, unsigned short low,
+  unsigned short high)
+  : grouping_(grouping), low_(low), high_(high)
+{
+  switch (grouping) {
+    case by_hour: buckets_.resize(24); break;
+    case by_weekday: buckets_.resize(7); break;
+    case by_tag: buckets_.resize(sizeof(tag_names) / sizeof(tag_names[0])); break;
+    case by_all: buckets_.resize(1); break;
+    case by_slot: buckets_.resize(minutes_per_day / 15); break;
+    default: break;
+  }
+}
+
+void record_aggregator::set_percentiles(const std::vector<double>& percentiles)
+{
+  percentiles_ = percentiles;
+  histograms_.assign(percentiles_.empty()? 0 : buckets_.size(), glucose_histogram());
+  day_histograms_.clear();
+}
+
+void record_aggregator::add(minutes_t minutes, unsigned short value, unsigned char tags,
+  unsigned char tag2)
+{
+  if ((tags & 128) || (minutes == record::no_minutes)) // not a glucose reading
+    return;
+
+  const bool in_range = (value >= low_) && (value <= high_);
+  const long day = floor_div(minutes, minutes_per_day);
+
+  switch (grouping_) {
+    case by_day:
+      days_[day].add(value, in_range);
+      if (!percentiles_.empty())
+        day_histograms_[day].add(value);
+      break;
+    case by_hour:
+      add_to((minutes - day * minutes_per_day) / 60, value, in_range);
+      break;
+    case by_weekday: // 1970-01-01 was a Thursday
+      add_to(day + 4 - floor_div(day + 4, 7) * 7, value, in_range);
+      break;
+    case by_tag:
+      for (size_t i = 0; i < 7; ++i)
+        if (tags & (1 << i))
+          add_to(i, value, in_range);
+      if (tag2)
+        add_to(tag_after_meal, value, in_range);
+      if (!tags && !tag2)
+        add_to(tag_none, value, in_range);
+      break;
+    case by_all:
+      add_to(0, value, in_range);
+      break;
+    case by_slot:
+      add_to((minutes - day * minutes_per_day) / 15, value, in_range);
+      break;
+  }
+}
+
+void record_aggregator::add(const record_table& table, const record_table::row_t* b,
+  const record_table::row_t* e)
+{
+  const minutes_t* minutes = table.minutes();
+  const unsigned short* values = table.values();
+  const unsigned char *tags = table.tags(), *tag2 = table.tag2();
+
+  for (; b != e; ++b)
+    add(minutes[*b], values[*b], tags[*b], tag2[*b]);
+}
+
+void record_aggregator::visit(const record* b, const record* e)
+{
+  for (; b != e; ++b)
+    add(*b);
+}
+
+void record_aggregator::merge(const record_aggregator& o)
+{
+  for (size_t i = 0; i < buckets_.size(); ++i)
+    buckets_[i].merge(o.buckets_[i]);
+  for (std::map<long, glucose_stats>::const_iterator d = o.days_.begin(); d != o.days_.end(); ++d)
+    days_[d->first].merge(d->second);
+
+  for (size_t i = 0; i < histograms_.size(); ++i)
+    histograms_[i].merge(o.histograms_[i]);
+  for (std::map<long, glucose_histogram>::const_iterator d = o.day_histograms_.begin();
+       d != o.day_histograms_.end(); ++d)
+    day_histograms_[d->first].merge(d->second);
+}
+
+namespace
+{
+
+// Writes the values of a row as CSV fields, or as JSON members named after
+// the CSV heading.
+struct row_writer
+{
+  std::ostream& os_;
+  bool json_, first_;
+
+  row_writer(std::ostream& os, bool json) : os_(os), json_(json), first_(true) {
+    if (json_)
+      os_ << "  {";
+  }
+
+  ~row_writer() {
+    if (json_)
+      os_ << '}';
+  }
+
+  template <typename T>
+  void field(const std::string& name, const T& value) {
+    if (!first_)
+      os_ << (json_? ", " : ",");
+    if (json_)
+      os_ << '"' << name << "\": ";
+    os_ << value;
+    first_ = false;
+  }
+
+  void key(const std::string& name, const std::string& value) {
+    field(name, json_? '"' + value + '"' : value);
+  }
+};
+
+} // namespace
+
+static std::string percentile_name(double p)
+{
+  std::ostringstream name;
+  name << 'p' << p;
+  return name.str();
+}
+
+void record_aggregator::print_row(std::ostream& os, const std::string& key,
+  const glucose_stats& s, const glucose_histogram* h, bool json) const
+{
+  // Formatted apart, to leave the flags of os alone.
+  std::ostringstream line;
+  line << std::fixed << std::setprecision(1);
+  {
+    row_writer row(line, json);
+    row.key(grouping_names[grouping_], key);
+    row.field("count", s.count);
+    row.field("mean", double(s.sum) / s.count);
+    row.field("min", s.min);
+    row.field("max", s.max);
+    row.field("in_range", 100.0 * s.in_range / s.count);
+
+    if (h) {
+      for (size_t i = 0; i < percentiles_.size(); ++i)
+        row.field(percentile_name(percentiles_[i]), h->quantile(percentiles_[i] / 100));
+      row.field("iqr", h->quantile(0.75) - h->quantile(0.25));
+    }
+  }
+  os << line.str();
+}
+
+void record_aggregator::print(std::ostream& os, bool json) const
+{
+  const bool histogram = !percentiles_.empty();
+
+  if (!json) {
+    os << grouping_names[grouping_] << ",count,mean,min,max,in_range";
+    for (size_t i = 0; i < percentiles_.size(); ++i)
+      os << ',' << percentile_name(percentiles_[i]);
+    os << (histogram? ",iqr\n" : "\n");
+  }
+  else
+    os << '[';
+
+  const char* sep = json? "\n" : "";
+  if (grouping_ == by_day) {
+    for (std::map<long, glucose_stats>::const_iterator d = days_.begin(); d != days_.end(); ++d) {
+      long y;
+      unsigned m, day;
+      civil_from_days(d->first, y, m, day);
+      std::ostringstream key;
+      key << std::setfill('0') << std::setw(4) << y << '-' << std::setw(2) << m << '-'
+          << std::setw(2) << day;
+
+      os << sep;
+      print_row(os, key.str(), d->second,
+        histogram? &day_histograms_.find(d->first)->second : NULL, json);
+      sep = json? ",\n" : "\n";
+    }
+  }
+  else {
+    for (size_t i = 0; i < buckets_.size(); ++i) {
+      if (!buckets_[i].count)
+        continue;
+
+      std::ostringstream key;
+      key << std::setfill('0');
+      switch (grouping_) {
+        case by_hour: key << std::setw(2) << i; break;
+        case by_slot: key << std::setw(2) << i / 4 << ':' << std::setw(2) << i % 4 * 15; break;
+        case by_weekday: key << weekday_names[i]; break;
+        case by_tag: key << tag_names[i]; break;
+        default: key << "all";
+      }
+
+      os << sep;
+      print_row(os, key.str(), buckets_[i], histogram? &histograms_[i] : NULL, json);
+      sep = json? ",\n" : "\n";
+    }
+  }
+
+  if (json)
+    os << "\n]\n";
+  else if (*sep)
+    os << '\n';
+}
@@ -0,0 +1,494 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <boost/crc.hpp>
+#include "contourpp_archive.hpp"
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+using namespace contourpp;
+
+static const char archive_magic[] = { 'C', 'T', 'P', 'A' };
+
+boost::uint32_t contourpp::crc32c(const unsigned char* b, const unsigned char* e)
+{
+#if defined(__SSE4_2__)
+  boost::uint64_t crc = 0xFFFFFFFF;
+  for (; e - b >= 8; b += 8) {
+    boost::uint64_t v;
+    std::memcpy(&v, b, 8);
+    crc = _mm_crc32_u64(crc, v);
+  }
+  boost::uint32_t crc32 = static_cast<boost::uint32_t>(crc);
+  for (; b < e; ++b)
+    crc32 = _mm_crc32_u8(crc32, *b);
+  return ~crc32;
+#else
+  boost::crc_optimal<32, 0x1EDC6F41, 0xFFFFFFFF, 0xFFFFFFFF, true, true> crc;
+  crc.process_block(b, e);
+  return crc.checksum();
+#endif
+}
+
+static inline void put_u32(std::vector<unsigned char>& buf, boost::uint32_t v)
+{
+  for (int i = 0; i < 4; ++i, v >>= 8)
+    buf.push_back(static_cast<unsigned char>(v));
+}
+
+static inline void put_varint(std::vector<unsigned char>& buf, boost::uint32_t v)
+{
+  while (v >= 0x80) {
+    buf.push_back(static_cast<unsigned char>(v | 0x80));
+    v >>= 7;
+  }
+  buf.push_back(static_cast<unsigned char>(v));
+}
+
+// Deltas are taken modulo 2^32, so that any two values have one.
+static inline void put_svarint(std::vector<unsigned char>& buf, boost::uint32_t v)
+{
+  put_varint(buf, (v << 1) ^ (0U - (v >> 31)));
+}
+
+static inline void put_string(std::vector<unsigned char>& buf, const std::string& s)
+{
+  put_varint(buf, static_cast<boost::uint32_t>(s.size()));
+  buf.insert(buf.end(), s.begin(), s.end());
+}
+
+static inline std::runtime_error corrupt(const char* what)
+{
+  return std::runtime_error(std::string("corrupt archive: ") + what);
+}
+
+static inline boost::uint32_t get_u32(const unsigned char*& p, const unsigned char* e)
+{
+  if (e - p < 4)
+    throw corrupt("truncated");
+  const boost::uint32_t v = p[0] | (boost::uint32_t(p[1]) << 8) |
+    (boost::uint32_t(p[2]) << 16) | (boost::uint32_t(p[3]) << 24);
+  p += 4;
+  return v;
+}
+
+static inline boost::uint32_t get_varint(const unsigned char*& p, const unsigned char* e)
+{
+  boost::uint32_t v = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (p >= e)
+      throw corrupt("truncated");
+    const unsigned char c = *p++;
+    v |= boost::uint32_t(c & 0x7F) << shift;
+    if (!(c & 0x80))
+      return v;
+  }
+  throw corrupt("bad varint");
+}
+
+static inline boost::uint32_t get_svarint(const unsigned char*& p, const unsigned char* e)
+{
+  const boost::uint32_t v = get_varint(p, e);
+  return (v >> 1) ^ (0U - (v & 1));
+}
+
+static inline void get_string(const unsigned char*& p, const unsigned char* e, std::string& s)
+{
+  const boost::uint32_t n = get_varint(p, e);
+  if (size_t(e - p) < n)
+    throw corrupt("truncated");
+  s.assign(reinterpret_cast<const char*>(p), n);
+  p += n;
+}
+
+void archive_writer::begin_segment(const meter_info& info)
+{
+  end_segment();
+  info_ = info;
+  in_segment_ = true;
+  header_written_ = false;
+  index_.clear();
+  segment_size_ = 0;
+  blocks_ = 0;
+  last_offset_ = 0;
+  last_min_ = 0;
+}
+
+void archive_writer::end_segment()
+{
+  if (!in_segment_)
+    return;
+
+  write_block();
+  if (header_written_) {
+    os_.put(0);
+
+    buf_.clear();
+    put_varint(buf_, static_cast<boost::uint32_t>(segment_size_));
+    put_varint(buf_, static_cast<boost::uint32_t>(blocks_));
+    buf_.insert(buf_.end(), index_.begin(), index_.end());
+
+    std::vector<unsigned char> size;
+    put_u32(size, static_cast<boost::uint32_t>(buf_.size()));
+    const boost::uint32_t crc = crc32c(buf_.data(), buf_.data() + buf_.size());
+    buf_.insert(buf_.begin(), size.begin(), size.end());
+    buf_.insert(buf_.end(), size.begin(), size.end());
+    put_u32(buf_, crc);
+    os_.write(reinterpret_cast<const char*>(buf_.data()), buf_.size());
+  }
+
+  in_segment_ = false;
+}
+
+void archive_writer::visit(const record* b, const record* e)
+{
+  if (!in_segment_)
+    begin_segment(meter_info());
+
+  while (b != e) {
+    const size_t n = std::min(size_t(e - b), block_records - pending_.size());
+    pending_.insert(pending_.end(), b, b + n);
+    b += n;
+    if (pending_.size() == block_records)
+      write_block();
+  }
+}
+
+void archive_writer::header(const meter_info& info)
+{
+  if (!in_segment_ || (info != info_))
+    begin_segment(info);
+}
+
+void archive_writer::write_header()
+{
+  buf_.assign(archive_magic, archive_magic + sizeof(archive_magic));
+  buf_.push_back(archive_version);
+  put_string(buf_, info_.product);
+  put_string(buf_, info_.versions);
+  put_string(buf_, info_.serial);
+  put_string(buf_, info_.sku);
+  put_u32(buf_, crc32c(buf_.data(), buf_.data() + buf_.size()));
+
+  os_.write(reinterpret_cast<const char*>(buf_.data()), buf_.size());
+  segment_size_ = buf_.size();
+  header_written_ = true;
+}
+
+void archive_writer::write_block()
+{
+  if (pending_.empty())
+    return;
+
+  if (!header_written_)
+    write_header();
+
+  const size_t n = pending_.size();
+  buf_.clear();
+
+  boost::uint32_t prev = 0;
+  minutes_t min = pending_[0].minutes(), max = min;
+  for (size_t i = 0; i < n; ++i) {
+    const minutes_t m = pending_[i].minutes();
+    min = std::min(min, m);
+    max = std::max(max, m);
+    const boost::uint32_t minutes = static_cast<boost::uint32_t>(m);
+    put_svarint(buf_, minutes - prev);
+    prev = minutes;
+  }
+
+  prev = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const boost::uint32_t index = static_cast<boost::uint32_t>(pending_[i].index());
+    put_svarint(buf_, index - prev);
+    prev = index;
+  }
+
+  for (size_t i = 0; i < n; ++i)
+    put_varint(buf_, pending_[i].value());
+  for (size_t i = 0; i < n; ++i)
+    buf_.push_back(pending_[i].tags());
+  for (size_t i = 0; i < n; ++i)
+    buf_.push_back(pending_[i].tag2());
+
+  std::vector<unsigned char> head;
+  put_varint(head, static_cast<boost::uint32_t>(n));
+  put_varint(head, static_cast<boost::uint32_t>(buf_.size()));
+  put_u32(head, crc32c(buf_.data(), buf_.data() + buf_.size()));
+
+  os_.write(reinterpret_cast<const char*>(head.data()), head.size());
+  os_.write(reinterpret_cast<const char*>(buf_.data()), buf_.size());
+  pending_.clear();
+
+  const boost::uint32_t offset = static_cast<boost::uint32_t>(segment_size_);
+  put_varint(index_, offset - last_offset_);
+  put_svarint(index_, static_cast<boost::uint32_t>(min) - last_min_);
+  put_varint(index_, static_cast<boost::uint32_t>(max) - static_cast<boost::uint32_t>(min));
+  last_offset_ = offset;
+  last_min_ = static_cast<boost::uint32_t>(min);
+  segment_size_ += head.size() + buf_.size();
+  ++blocks_;
+}
+
+bool archive_reader::is_archive(const char* b, const char* e)
+{
+  return (size_t(e - b) > sizeof(archive_magic)) &&
+    (std::memcmp(b, archive_magic, sizeof(archive_magic)) == 0);
+}
+
+bool archive_reader::next_segment()
+{
+  while (in_segment_)
+    skip_block();
+
+  if (p_ >= e_)
+    return false;
+
+  if (!is_archive(p_, e_))
+    throw corrupt("bad segment header");
+
+  const unsigned char* b = reinterpret_cast<const unsigned char*>(p_);
+  const unsigned char* e = reinterpret_cast<const unsigned char*>(e_);
+  const unsigned char* p = b + sizeof(archive_magic);
+
+  version_ = *p++;
+  if ((version_ < 1) || (version_ > archive_version))
+    throw std::runtime_error("unsupported archive version");
+
+  get_string(p, e, info_.product);
+  get_string(p, e, info_.versions);
+  get_string(p, e, info_.serial);
+  get_string(p, e, info_.sku);
+
+  const boost::uint32_t crc = crc32c(b, p);
+  if (get_u32(p, e) != crc)
+    throw corrupt("header checksum mismatch");
+
+  p_ = reinterpret_cast<const char*>(p);
+  in_segment_ = true;
+  return true;
+}
+
+bool archive_reader::read_block_header(boost::uint32_t& n, const unsigned char*& payload,
+  const unsigned char*& payload_end, boost::uint32_t& crc)
+{
+  if (!in_segment_)
+    return false;
+
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(p_);
+  const unsigned char* e = reinterpret_cast<const unsigned char*>(e_);
+
+  n = get_varint(p, e);
+  if (n == 0) {
+    if (version_ >= 2) { // skip the trailer
+      const boost::uint32_t size = get_u32(p, e);
+      if (size_t(e - p) < size_t(size) + 8)
+        throw corrupt("truncated");
+      p += size;
+      if (get_u32(p, e) != size)
+        throw corrupt("bad trailer");
+      p += 4;
+    }
+    p_ = reinterpret_cast<const char*>(p);
+    in_segment_ = false;
+    return false;
+  }
+
+  const boost::uint32_t size = get_varint(p, e);
+  crc = get_u32(p, e);
+  if (size_t(e - p) < size)
+    throw corrupt("truncated");
+
+  payload = p;
+  payload_end = p + size;
+  p_ = reinterpret_cast<const char*>(payload_end);
+  return true;
+}
+
+bool archive_reader::skip_block()
+{
+  boost::uint32_t n, crc;
+  const unsigned char *p, *pe;
+  return read_block_header(n, p, pe, crc);
+}
+
+bool archive_reader::next_block(record_table& table)
+{
+  boost::uint32_t n, crc;
+  const unsigned char *p, *pe;
+  if (!read_block_header(n, p, pe, crc))
+    return false;
+
+  if (crc32c(p, pe) != crc)
+    throw corrupt("block checksum mismatch");
+
+  if (size_t(pe - p) < 5 * size_t(n)) // at least one byte per column
+    throw corrupt("bad block size");
+
+  const size_t row = table.grow(n);
+
+  minutes_t* minutes = table.minutes() + row;
+  boost::uint32_t prev = 0;
+  for (size_t i = 0; i < n; ++i)
+    minutes[i] = static_cast<minutes_t>(prev += get_svarint(p, pe));
+
+  boost::uint32_t* indices = table.indices() + row;
+  prev = 0;
+  for (size_t i = 0; i < n; ++i)
+    indices[i] = (prev += get_svarint(p, pe));
+
+  unsigned short* values = table.values() + row;
+  for (size_t i = 0; i < n; ++i)
+    values[i] = static_cast<unsigned short>(get_varint(p, pe));
+
+  if (size_t(pe - p) != 2 * size_t(n))
+    throw corrupt("bad block size");
+
+  std::memcpy(table.tags() + row, p, n);
+  std::memcpy(table.tag2() + row, p + n, n);
+  return true;
+}
+
+void archive_reader::read_all(record_table& table)
+{
+  while (next_segment()) {
+    table.header(info_);
+    while (next_block(table));
+  }
+}
+
+void archive_reader::read_all(record_visitor& visitor)
+{
+  record_table block;
+  block.reserve(archive_writer::block_records);
+
+  while (next_segment()) {
+    visitor.header(info_);
+    for (block.clear(); next_block(block); block.clear())
+      block.replay(0, block.size(), visitor);
+  }
+}
+
+// Find the segment whose trailer ends at e, returning its start and its
+// index, or NULL if there is no (valid) trailer there.
+static const char* find_segment(const char* b, const char* e,
+  const unsigned char*& index, const unsigned char*& index_end)
+{
+  const unsigned char* ub = reinterpret_cast<const unsigned char*>(b);
+  const unsigned char* ue = reinterpret_cast<const unsigned char*>(e);
+  if (ue - ub < 13)
+    return NULL;
+
+  const unsigned char* p = ue - 8;
+  const boost::uint32_t size = get_u32(p, ue);
+  const boost::uint32_t crc = get_u32(p, ue);
+  if (size_t(ue - ub) < size_t(size) + 13)
+    return NULL;
+
+  index_end = ue - 8;
+  index = index_end - size;
+  p = index - 4;
+  if ((get_u32(p, ue) != size) || (index[-5] != 0) || (crc32c(index, index_end) != crc))
+    return NULL;
+
+  p = index;
+  const boost::uint32_t segment_size = get_varint(p, index_end);
+  const char* segment = reinterpret_cast<const char*>(index - 5) - segment_size;
+  if ((segment_size > size_t(e - b)) || (segment < b) ||
+      !archive_reader::is_archive(segment, e) || (segment[4] < 2))
+    return NULL;
+
+  return segment;
+}
+
+// Pass the rows of table with minutes in [from, to] to visitor.
+static void visit_range(const record_table& table, minutes_t from, minutes_t to,
+  record_visitor& visitor)
+{
+  static const size_t batch_size = 256;
+  record batch[batch_size];
+  size_t n = 0;
+
+  const minutes_t* minutes = table.minutes();
+  for (size_t i = 0, size = table.size(); i < size; ++i) {
+    if ((minutes[i] < from) || (minutes[i] > to))
+      continue;
+    batch[n++] = table[i];
+    if (n == batch_size) {
+      visitor.visit(batch, batch + n);
+      n = 0;
+    }
+  }
+
+  if (n)
+    visitor.visit(batch, batch + n);
+}
+
+void archive_reader::read_range(minutes_t from, minutes_t to, record_visitor& visitor)
+{
+  while (in_segment_)
+    skip_block();
+
+  // Collect the indexed segments at the end of the archive, walking back
+  // from trailer to trailer.
+  typedef std::pair<const unsigned char*, const unsigned char*> index_t;
+  std::vector<std::pair<const char*, index_t> > indexed;
+  const char* stop = e_;
+  index_t index;
+  for (const char* segment; (stop > p_) &&
+      (segment = find_segment(p_, stop, index.first, index.second)); stop = segment)
+    indexed.push_back(std::make_pair(segment, index));
+
+  record_table block;
+  block.reserve(archive_writer::block_records);
+
+  // The segments in front of them have to be decoded in full.
+  while ((p_ < stop) && next_segment()) {
+    visitor.header(info_);
+    for (block.clear(); next_block(block); block.clear())
+      visit_range(block, from, to, visitor);
+  }
+
+  for (size_t i = indexed.size(); i-- > 0; )
+    read_range(indexed[i].first, indexed[i].second.first, indexed[i].second.second,
+      from, to, block, visitor);
+
+  p_ = e_;
+  in_segment_ = false;
+}
+
+void archive_reader::read_range(const char* segment, const unsigned char* p,
+  const unsigned char* e, minutes_t from, minutes_t to, record_table& block,
+  record_visitor& visitor)
+{
+  p_ = segment;
+  in_segment_ = false;
+  next_segment();
+  visitor.header(info_);
+
+  const boost::uint32_t segment_size = get_varint(p, e);
+  const boost::uint32_t n = get_varint(p, e);
+  boost::uint32_t offset = 0, min = 0;
+
+  for (boost::uint32_t i = 0; i < n; ++i) {
+    offset += get_varint(p, e);
+    min += get_svarint(p, e);
+    const boost::uint32_t span = get_varint(p, e);
+    if (offset >= segment_size)
+      throw corrupt("bad index");
+
+    // Compare as 64 bits, so that max cannot wrap around.
+    const boost::int64_t block_min = static_cast<minutes_t>(min);
+    if ((block_min > to) || (block_min + span < from))
+      continue;
+
+    p_ = segment + offset;
+    block.clear();
+    if (!next_block(block))
+      throw corrupt("bad index");
+    visit_range(block, from, to, visitor);
+  }
+}
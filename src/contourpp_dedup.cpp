@@ -0,0 +1,69 @@
+#include "contourpp_dedup.hpp"
+#include "contourpp_sort.hpp"
+
+using namespace contourpp;
+
+serial_ids::serial_t serial_ids::id(const std::string& serial)
+{
+  std::map<std::string, serial_t>::iterator i = ids_.find(serial);
+  if (i == ids_.end())
+    i = ids_.insert(std::make_pair(serial, serial_t(ids_.size() + 1))).first;
+  return i->second;
+}
+
+void serial_ids::ids(const record_table& table, std::vector<serial_t>& ids)
+{
+  ids.resize(table.meters().size());
+  for (size_t i = 0; i < ids.size(); ++i)
+    ids[i] = id(table.meters()[i].serial);
+}
+
+record_set::record_set()
+  : slots_(1024), size_(0)
+{
+}
+
+bool record_set::insert(serial_t serial, minutes_t minutes, boost::uint32_t index)
+{
+  const size_t mask = slots_.size() - 1;
+  for (size_t i = record_hash(minutes, index, serial) & mask; ; i = (i + 1) & mask) {
+    slot& s = slots_[i];
+    if (s.serial == 0) {
+      s.minutes = minutes;
+      s.index = index;
+      s.serial = serial;
+      if (2 * ++size_ > slots_.size())
+        grow();
+      return true;
+    }
+    if ((s.minutes == minutes) && (s.index == index) && (s.serial == serial))
+      return false;
+  }
+}
+
+void record_set::grow()
+{
+  std::vector<slot> old(2 * slots_.size());
+  old.swap(slots_);
+  size_ = 0;
+  for (size_t i = 0; i < old.size(); ++i)
+    if (old[i].serial != 0)
+      insert(old[i].serial, old[i].minutes, old[i].index);
+}
+
+void record_set::filter(const record_table& table, std::vector<record_table::row_t>& rows)
+{
+  std::vector<serial_t> serials;
+  serials_.ids(table, serials);
+
+  const minutes_t* minutes = table.minutes();
+  const boost::uint32_t* indices = table.indices();
+  const record_table::meter_t* meter_ids = table.meter_ids();
+  size_t n = 0;
+  for (size_t i = 0; i < rows.size(); ++i) {
+    const record_table::row_t r = rows[i];
+    if (insert(serials[meter_ids[r]], minutes[r], indices[r]))
+      rows[n++] = r;
+  }
+  rows.resize(n);
+}
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <boost/cstdint.hpp>
+#include "contourpp_dedup.hpp"
+#include "contourpp_diff.hpp"
+#include "contourpp_sort.hpp"
+
+using namespace contourpp;
+
+namespace
+{
+
+typedef record_table::row_t row_t;
+
+// The fields compared, of a row of a table.
+struct row_key
+{
+  const record_table& table;
+  const std::vector<boost::uint32_t>& serials;
+
+  row_key(const record_table& t, const std::vector<boost::uint32_t>& s) : table(t), serials(s) {}
+
+  boost::uint32_t serial(row_t r) const { return serials[table.meter_ids()[r]]; }
+  minutes_t minutes(row_t r) const { return table.minutes()[r]; }
+  boost::uint32_t index(row_t r) const { return table.indices()[r]; }
+  unsigned short value(row_t r) const { return table.values()[r]; }
+};
+
+// An open-addressing hash table (linear probing, at most half full) of the
+// records of a table, each marked when found in the other table.
+class record_index
+{
+private:
+  struct slot
+  {
+    minutes_t minutes;
+    boost::uint32_t index;
+    boost::uint32_t serial; // 0 if the slot is empty
+    unsigned short value;
+    bool found;
+  };
+
+  std::vector<slot> slots_;
+
+  // The slot of the record of row r, or the empty slot where it would go.
+  slot& find(const row_key& k, row_t r) {
+    const size_t mask = slots_.size() - 1;
+    const boost::uint32_t serial = k.serial(r);
+    const minutes_t minutes = k.minutes(r);
+    const boost::uint32_t index = k.index(r);
+    const unsigned short value = k.value(r);
+    const size_t h = record_hash(minutes, index, boost::uint64_t(serial) << 16 | value);
+    for (size_t i = h & mask; ; i = (i + 1) & mask) {
+      slot& s = slots_[i];
+      if ((s.serial == 0) || ((s.minutes == minutes) && (s.index == index) &&
+          (s.serial == serial) && (s.value == value)))
+        return s;
+    }
+  }
+
+public:
+  explicit record_index(size_t n) {
+    size_t size = 16;
+    while (size < 2 * n)
+      size *= 2;
+    slot empty = slot();
+    slots_.assign(size, empty);
+  }
+
+  void insert(const row_key& k, row_t r) {
+    slot& s = find(k, r);
+    if (s.serial == 0) {
+      s.minutes = k.minutes(r);
+      s.index = k.index(r);
+      s.serial = k.serial(r);
+      s.value = k.value(r);
+    }
+  }
+
+  // Mark the record of row r as found, returning false if there is none.
+  bool mark(const row_key& k, row_t r) {
+    slot& s = find(k, r);
+    if (s.serial == 0)
+      return false;
+    s.found = true;
+    return true;
+  }
+
+  bool found(const row_key& k, row_t r) { return find(k, r).found; }
+};
+
+void hash_join(const row_key& small, const row_key& large, std::vector<row_t>& only_small,
+  std::vector<row_t>& only_large)
+{
+  const row_t n = static_cast<row_t>(small.table.size());
+  const row_t m = static_cast<row_t>(large.table.size());
+
+  record_index index(n);
+  for (row_t r = 0; r < n; ++r)
+    index.insert(small, r);
+  for (row_t r = 0; r < m; ++r)
+    if (!index.mark(large, r))
+      only_large.push_back(r);
+  for (row_t r = 0; r < n; ++r)
+    if (!index.found(small, r))
+      only_small.push_back(r);
+}
+
+// The rows of a table sorted by serial number, time, index and value.
+void sort_rows(const row_key& k, std::vector<keyed_row>& rows, size_t jobs)
+{
+  const row_t n = static_cast<row_t>(k.table.size());
+  rows.resize(n);
+  std::vector<keyed_row> tmp(n);
+
+  // The least significant fields first, then the rest (keeping that order).
+  for (row_t r = 0; r < n; ++r) {
+    rows[r].key = k.value(r);
+    rows[r].row = r;
+  }
+  radix_sort(rows.data(), rows.data() + n, tmp.data(), keyed_row_key(), jobs);
+  for (row_t i = 0; i < n; ++i)
+    rows[i].key = sort_key(k.minutes(rows[i].row), k.index(rows[i].row));
+  radix_sort(rows.data(), rows.data() + n, tmp.data(), keyed_row_key(), jobs);
+  for (row_t i = 0; i < n; ++i)
+    rows[i].key = k.serial(rows[i].row);
+  radix_sort(rows.data(), rows.data() + n, tmp.data(), keyed_row_key(), jobs);
+}
+
+// -1, 0 or 1 as row r of a is before, the same as or after row s of b.
+int compare(const row_key& a, row_t r, const row_key& b, row_t s)
+{
+  if (a.serial(r) != b.serial(s))
+    return (a.serial(r) < b.serial(s))? -1 : 1;
+  if (a.minutes(r) != b.minutes(s))
+    return (a.minutes(r) < b.minutes(s))? -1 : 1;
+  if (a.index(r) != b.index(s))
+    return (a.index(r) < b.index(s))? -1 : 1;
+  if (a.value(r) != b.value(s))
+    return (a.value(r) < b.value(s))? -1 : 1;
+  return 0;
+}
+
+void sort_merge(const row_key& a, const row_key& b, std::vector<row_t>& only_a,
+  std::vector<row_t>& only_b, size_t jobs)
+{
+  std::vector<keyed_row> x, y;
+  sort_rows(a, x, jobs);
+  sort_rows(b, y, jobs);
+
+  size_t i = 0, j = 0;
+  while ((i < x.size()) && (j < y.size())) {
+    const int c = compare(a, x[i].row, b, y[j].row);
+    if (c < 0)
+      only_a.push_back(x[i++].row);
+    else if (c > 0)
+      only_b.push_back(y[j++].row);
+    else {
+      // Skip the records equal to these on both sides.
+      const row_t r = x[i].row, s = y[j].row;
+      while ((i < x.size()) && (compare(a, x[i].row, a, r) == 0))
+        ++i;
+      while ((j < y.size()) && (compare(b, y[j].row, b, s) == 0))
+        ++j;
+    }
+  }
+  for (; i < x.size(); ++i)
+    only_a.push_back(x[i].row);
+  for (; j < y.size(); ++j)
+    only_b.push_back(y[j].row);
+
+  // Back to the order of the tables.
+  std::sort(only_a.begin(), only_a.end());
+  std::sort(only_b.begin(), only_b.end());
+}
+
+void copy_rows(const record_table& table, const std::vector<row_t>& rows, record_table& out)
+{
+  out.clear();
+  out.reserve(rows.size());
+  for (size_t i = 0; i < rows.size(); ++i) {
+    out.header(table.meters()[table.meter_ids()[rows[i]]]);
+    out.push_back(table[rows[i]]);
+  }
+}
+
+} // namespace
+
+void contourpp::diff_tables(const record_table& a, const record_table& b, record_table& only_a,
+  record_table& only_b, size_t jobs)
+{
+  serial_ids ids;
+  std::vector<serial_ids::serial_t> a_serials, b_serials;
+  ids.ids(a, a_serials);
+  ids.ids(b, b_serials);
+  const row_key a_key(a, a_serials), b_key(b, b_serials);
+
+  std::vector<row_t> a_rows, b_rows;
+  if (std::min(a.size(), b.size()) > hash_join_limit)
+    sort_merge(a_key, b_key, a_rows, b_rows, jobs);
+  else if (a.size() <= b.size())
+    hash_join(a_key, b_key, a_rows, b_rows);
+  else
+    hash_join(b_key, a_key, b_rows, a_rows);
+
+  copy_rows(a, a_rows, only_a);
+  copy_rows(b, b_rows, only_b);
+}
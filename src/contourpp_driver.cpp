@@ -1,9 +1,14 @@
 #include <algorithm>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <istream>
 #include <iostream>
+#include <sstream>
+#include <boost/cstdint.hpp>
 #include "contourpp_driver.hpp"
+#include "contourpp_parallel.hpp"
+#include "contourpp_scanner.hpp"
 #include "hid_commands.hpp"
 
 //referencemap['B'] = "whole blood";
@@ -34,9 +39,75 @@ static bool equals(const std::string& s, const char* b, const char* e)
   return true;
 }
 
+// SWAR helpers: up to eight ASCII characters are loaded into one 64-bit word
+// (first character in the lowest byte) and validated or converted with a few
+// word-wide operations instead of one branch per character.
+typedef boost::uint64_t swar_t;
+
+static const swar_t swar_high = 0x8080808080808080ULL;
+static const swar_t swar_low7 = 0x7F7F7F7F7F7F7F7FULL;
+static const swar_t swar_zeros = 0x3030303030303030ULL; // "00000000"
+static const swar_t swar_nines = 0x3939393939393939ULL; // "99999999"
+
+static inline swar_t swar_load(const char* b)
+{
+  const unsigned char* u = reinterpret_cast<const unsigned char*>(b);
+  return  swar_t(u[0])        | (swar_t(u[1]) <<  8) | (swar_t(u[2]) << 16) | (swar_t(u[3]) << 24)
+       | (swar_t(u[4]) << 32) | (swar_t(u[5]) << 40) | (swar_t(u[6]) << 48) | (swar_t(u[7]) << 56);
+}
+
+// True if every byte of x lies in ['0', the corresponding byte of max].
+static inline bool swar_is_digits(swar_t x, swar_t max = swar_nines)
+{
+  const swar_t below = ~((x | swar_high) - swar_zeros) & swar_high;
+  const swar_t above = (((x & swar_low7) + (swar_low7 - max)) | x) & swar_high;
+  return (below | above) == 0;
+}
+
+// Convert eight digits (already validated) to two-digit values, one in the
+// low byte of each 16-bit lane.
+static inline swar_t swar_pairs(swar_t x)
+{
+  x -= swar_zeros;
+  return ((x * 10) + (x >> 8)) & 0x00FF00FF00FF00FFULL;
+}
+
+// Convert eight digits (already validated) to their value.
+static inline boost::uint32_t swar_value(swar_t x)
+{
+  x = swar_pairs(x);
+  x = ((x * 100) + (x >> 16)) & 0x0000FFFF0000FFFFULL;
+  return static_cast<boost::uint32_t>((x * 10000) + (x >> 32));
+}
+
+// Parse the digits of [b, f) into n; up to eight digits are converted at
+// once if at least eight bytes are readable before e.
+template <typename T>
+static inline bool parse_digits(const char* b, const char* f, const char* e, T& n)
+{
+  const size_t len = f - b;
+  if ((len > 0) && (len <= 8) && (e - b >= 8)) {
+    swar_t x = swar_load(b);
+    if (len < 8) // right-align the digits, padding with leading '0's
+      x = (x << (8 * (8 - len))) | (swar_zeros >> (8 * len));
+    if (!swar_is_digits(x))
+      return false;
+    n = static_cast<T>(swar_value(x));
+    return true;
+  }
+
+  for (n = 0; b < f; ++b) {
+    if ((*b < '0') || (*b > '9')) return false;
+    n = (n * 10) + (*b - '0');
+  }
+  return true;
+}
+
 static const unsigned char bayer_type_idx_unknown =
   (sizeof(bayer_types) / sizeof(bayer_types[0])) - 1;
 
+const contourpp::minutes_t contourpp::record::no_minutes;
+
 const char* contourpp::record::get_bayer_type() const
 {
   unsigned char tidx = bayer_type_idx_unknown;
@@ -53,6 +124,183 @@ const char* contourpp::record::get_bayer_type2() const
   return bayer_types2[tidx].c_str();
 }
 
+static inline char* put_string(char* p, const char* s)
+{
+  while (*s)
+    *p++ = *s++;
+  return p;
+}
+
+static inline char* put_uint(char* p, unsigned long v)
+{
+  char digits[20];
+  char* d = digits + sizeof(digits);
+  do {
+    *--d = static_cast<char>('0' + (v % 10));
+    v /= 10;
+  } while (v);
+  return std::copy(d, digits + sizeof(digits), p);
+}
+
+static inline char* put_2digits(char* p, unsigned v)
+{
+  p[0] = static_cast<char>('0' + v / 10);
+  p[1] = static_cast<char>('0' + v % 10);
+  return p + 2;
+}
+
+// "HH:MM" of each minute of the day.
+struct clock_times
+{
+  char text[contourpp::minutes_per_day][5];
+
+  clock_times() {
+    for (unsigned m = 0; m < unsigned(contourpp::minutes_per_day); ++m) {
+      put_2digits(text[m], m / 60);
+      text[m][2] = ':';
+      put_2digits(text[m] + 3, m % 60);
+    }
+  }
+};
+
+static const clock_times clock_time;
+
+// Render the date of day as "YYYY-MM-DD" into dates, unless it is there
+// already.
+static inline const char* render_date(long day, contourpp::record::date_cache& dates)
+{
+  if (dates.day != day) {
+    long y;
+    unsigned m, d;
+    contourpp::civil_from_days(day, y, m, d);
+
+    char* p = put_2digits(dates.text, static_cast<unsigned>(y / 100));
+    p = put_2digits(p, static_cast<unsigned>(y % 100));
+    *p++ = '-';
+    p = put_2digits(p, m);
+    *p++ = '-';
+    put_2digits(p, d);
+    dates.day = day;
+  }
+  return dates.text;
+}
+
+// Write minutes as strftime would with "%Y-%m-%d %H:%M", or with
+// "%Y%m%d%H%M" for compact.
+static char* put_minutes(char* p, contourpp::minutes_t m, bool compact,
+  contourpp::record::date_cache* dates)
+{
+  if (m == contourpp::record::no_minutes)
+    return put_string(p, "not-a-date-time");
+
+  const long day = contourpp::floor_div(m, contourpp::minutes_per_day);
+  const char* time = clock_time.text[m - day * contourpp::minutes_per_day];
+  contourpp::record::date_cache local;
+  const char* date = render_date(day, dates? *dates : local);
+
+  if (compact) {
+    std::memcpy(p, date, 4);
+    std::memcpy(p + 4, date + 5, 2);
+    std::memcpy(p + 6, date + 8, 2);
+    std::memcpy(p + 8, time, 2);
+    std::memcpy(p + 10, time + 3, 2);
+    return p + 12;
+  }
+
+  std::memcpy(p, date, 10);
+  p[10] = ' ';
+  std::memcpy(p + 11, time, 5);
+  return p + 16;
+}
+
+// hr_after_meal() of each tag2, as printed by an ostream.
+struct after_meal_hours
+{
+  std::string text[256];
+
+  after_meal_hours() {
+    for (unsigned i = 0; i < 256; ++i) {
+      std::ostringstream os;
+      os << float(i) / 60;
+      text[i] = os.str();
+    }
+  }
+};
+
+static const after_meal_hours hours_after_meal;
+
+char* contourpp::record::format_bayer(char* p, char field_sep, date_cache* dates) const
+{
+  *p++ = 'R';
+  *p++ = field_sep;
+  p = put_uint(p, index_);
+  *p++ = field_sep;
+  p = put_string(p, get_bayer_type());
+  *p++ = field_sep;
+  p = put_uint(p, value_);
+  *p++ = field_sep;
+  p = put_string(p, get_bayer_type2());
+  *p++ = field_sep;
+  *p++ = field_sep;
+
+  if (is_glucose()) {
+    static const char letters[] = "CBADISX";
+    bool attr_printed = false;
+    for (size_t i = 0; i < 7; i++) {
+      if (tags_ & (1 << i)) {
+        if (attr_printed) *p++ = '/';
+        *p++ = letters[i];
+        attr_printed = true;
+      }
+    }
+
+    if (tag2_ > 0) {
+      char c = static_cast<char>(static_cast<unsigned short>(tag2_) / 15);
+      c += (c > 9)? ('A' - 10) : '0';
+      if (attr_printed) *p++ = '/';
+      *p++ = 'Z';
+      *p++ = c;
+    }
+  }
+
+  *p++ = field_sep;
+  *p++ = field_sep;
+  return put_minutes(p, minutes_, true, dates);
+}
+
+char* contourpp::record::format_csv(char* p, char field_sep, date_cache* dates) const
+{
+  p = put_minutes(p, minutes_, false, dates);
+  *p++ = field_sep;
+  p = put_uint(p, value_);
+
+  if (is_glucose()) {
+    *p++ = field_sep;
+    if (is_before_food()) *p++ = '1';
+    else if (is_after_food()) *p++ = '2';
+    *p++ = field_sep;
+    if (dont_feel_right()) *p++ = '1';
+    *p++ = field_sep;
+    if (is_sick()) *p++ = '1';
+    *p++ = field_sep;
+    if (has_stress()) *p++ = '1';
+    *p++ = field_sep;
+    if (has_activity()) *p++ = '1';
+
+    if (tag2_) {
+      *p++ = field_sep;
+      p = put_string(p, hours_after_meal.text[tag2_].c_str());
+    }
+  }
+  else {
+    *p++ = field_sep;
+    *p++ = '-';
+    p = put_uint(p, 1U + tag2_);
+  }
+
+  return p;
+}
+
 bool contourpp::record::parse_bayer(const char* b, const char* e, char field_sep)
 {
   clear();
@@ -93,32 +341,8 @@ bool contourpp::record::parse_bayer(const char* b, const char* e, char field_sep
     return false;
 
   if (0 == tidx) { // Glucose - parse tags
-    for (++b; (b < e) && (*b != field_sep); ++b) {
-      switch (*b) {
-        case 'C': tags_ |=  1; continue; // control
-        case 'B': tags_ |=  2; continue; // before food
-        case 'A': tags_ |=  4; continue; // after food
-        case 'D': tags_ |=  8; continue; // don't feel right
-        case 'I': tags_ |= 16; continue; // sick
-        case 'S': tags_ |= 32; continue; // stress
-        case 'X': tags_ |= 64; continue; // activity
-        case '<': value_ =  9; continue; // result low
-        case '>': value_ = 601; continue; // result high
-        case '/': continue;
-        case 'Z':
-          tags_ |= 4; // after food
-          if (++b >= e)
-            return false;
-          else if ((*b >= '0') && (*b <= '9'))
-            tag2_ = 15 * (*b - '0');
-          else if ((*b >= 'A') && (*b <= 'F'))
-            tag2_ = 15 * (*b - 'A' + 10);
-          else if ((*b >= 'a') && (*b <= 'f'))
-            tag2_ = 15 * (*b - 'a' + 10);
-          else
-            return false;
-      }
-    }
+    if (!(b = parse_bayer_tags(++b, e, field_sep)))
+      return false;
   }
   else {
     tags_ = 128;
@@ -132,27 +356,111 @@ bool contourpp::record::parse_bayer(const char* b, const char* e, char field_sep
   if ((b = std::find(++b, e, field_sep)) >= e)
     return false;
 
-  ++b;
+  return parse_bayer_datetime(++b, e);
+}
+
+bool contourpp::record::parse_bayer(const char* b, const char* e,
+  const unsigned int* seps, size_t nseps, const char* base)
+{
+  clear();
+
+  // R|index|type|value|units|reference range|tags|status|...|datetime
+  if ((nseps < 8) || (e - b < 2) || (base + seps[0] != b))
+    return false;
+
+  const char* f[8];
+  for (size_t i = 0; i < 8; ++i)
+    f[i] = base + seps[i];
+
+  if (!parse_digits(f[0] + 1, f[1], e, index_))
+    return false;
+
+  unsigned char tidx = 0;
+  while ((tidx < bayer_type_idx_unknown) && !equals(bayer_types[tidx], f[1] + 1, f[2]))
+    ++tidx;
+
+  if (!parse_digits(f[2] + 1, f[3], e, value_))
+    return false;
+
+  if (1 == tidx) // Insulin - Short or long acting?
+    tidx += equals(bayer_types2[2], f[3] + 1, f[4]);
+
+  if (0 == tidx) { // Glucose - parse tags
+    if (!parse_bayer_tags(f[5] + 1, e, *f[5]))
+      return false;
+  }
+  else {
+    tags_ = 128;
+    tag2_ = tidx - 1;
+  }
+
+  return parse_bayer_datetime(f[7] + 1, e);
+}
+
+const char* contourpp::record::parse_bayer_tags(const char* b, const char* e, char field_sep)
+{
+  for (; (b < e) && (*b != field_sep); ++b) {
+    switch (*b) {
+      case 'C': tags_ |=  1; continue; // control
+      case 'B': tags_ |=  2; continue; // before food
+      case 'A': tags_ |=  4; continue; // after food
+      case 'D': tags_ |=  8; continue; // don't feel right
+      case 'I': tags_ |= 16; continue; // sick
+      case 'S': tags_ |= 32; continue; // stress
+      case 'X': tags_ |= 64; continue; // activity
+      case '<': value_ =  9; continue; // result low
+      case '>': value_ = 601; continue; // result high
+      case '/': continue;
+      case 'Z':
+        tags_ |= 4; // after food
+        if (++b >= e)
+          return NULL;
+        else if ((*b >= '0') && (*b <= '9'))
+          tag2_ = 15 * (*b - '0');
+        else if ((*b >= 'A') && (*b <= 'F'))
+          tag2_ = 15 * (*b - 'A' + 10);
+        else if ((*b >= 'a') && (*b <= 'f'))
+          tag2_ = 15 * (*b - 'a' + 10);
+        else
+          return NULL;
+    }
+  }
+
+  return b;
+}
+
+bool contourpp::record::parse_bayer_datetime(const char* b, const char* e)
+{
+  // Upper bounds of each character of YYYYMMDD and HHMM ("9999193929699999").
+  static const swar_t date_max = 0x3933393139393939ULL;
+  static const swar_t time_max = 0x3939393939363932ULL;
+
   if (e - b < 12)
     return false;
 
-  if (b[ 0] < '0' || b[ 1] < '0' || b[ 2] < '0' || b[ 3] < '0') return false;
-  if (b[ 4] < '0' || b[ 5] < '0' || b[ 6] < '0' || b[ 7] < '0') return false;
-  if (b[ 8] < '0' || b[ 9] < '0' || b[10] < '0' || b[11] < '0') return false;
-  if (b[ 0] > '9' || b[ 1] > '9' || b[ 2] > '9' || b[ 3] > '9') return false;
-  if (b[ 4] > '1' || b[ 5] > '9' || b[ 6] > '3' || b[ 7] > '9') return false;
-  if (b[ 8] > '2' || b[ 9] > '9' || b[10] > '6' || b[11] > '9') return false;
+  // The time is padded to eight characters with "0000".
+  const swar_t d = swar_load(b);
+  const swar_t t = (swar_load(b + 4) >> 32) | (swar_zeros << 32);
+  if (!swar_is_digits(d, date_max) || !swar_is_digits(t, time_max))
+    return false;
+
+  const swar_t dp = swar_pairs(d), tp = swar_pairs(t);
+  const long year = (dp & 0xFF) * 100 + ((dp >> 16) & 0xFF);
+  const unsigned month = (dp >> 32) & 0xFF, day = (dp >> 48) & 0xFF;
 
-  datetime_ = datetime_t(
-    boost::gregorian::date(
-      (b[ 0] - '0') * 1000 + (b[ 1] - '0') * 100 + (b[ 2] - '0') * 10 + (b[ 3] - '0'),
-      (b[ 4] - '0') *   10 + (b[ 5] - '0'),        (b[ 6] - '0') * 10 + (b[ 7] - '0')
-    ),
-    boost::posix_time::time_duration(
-      (b[ 8] - '0') *   10 + (b[ 9] - '0'), (b[10] - '0') * 10 + (b[11] - '0'), 0
-    )
-  );
+  if ((year < 1400) || (month < 1) || (month > 12) || (day < 1) ||
+    (day > last_day_of_month(year, month))) {
+    boost::gregorian::date(year, month, day); // throws the matching bad_* error
+    return false;
+  }
 
+  // Hours and minutes are not range checked (as with a time_duration).
+  const long long m = static_cast<long long>(days_from_civil(year, month, day)) * minutes_per_day
+    + (tp & 0xFF) * 60 + ((tp >> 16) & 0xFF);
+  if (m > 2147483647LL)
+    return false;
+
+  minutes_ = static_cast<minutes_t>(m);
   return true;
 }
 
@@ -184,14 +492,153 @@ static short get_digits(const char* b, const char* e, int min_digits, int max_di
 }
 */
 
-bool contourpp::record::parse_csv(const char* b, const char* e, char field_sep)
+static inline bool parse_2digits(const char* b, unsigned& n)
+{
+  if ((b[0] < '0') || (b[0] > '9') || (b[1] < '0') || (b[1] > '9'))
+    return false;
+  n = 10 * (b[0] - '0') + (b[1] - '0');
+  return true;
+}
+
+// Parse the hours after meal printed for a tag2, e.g. "0.25" or "1.66667".
+static bool parse_after_meal(const char* b, const char* e, unsigned char& tag2)
+{
+  // Read the number as num / den, and round it to whole minutes.
+  unsigned long long num = 0, den = 1;
+  const char* p = b;
+  for (; (p < e) && (*p >= '0') && (*p <= '9') && (p - b < 3); ++p)
+    num = 10 * num + (*p - '0');
+  if ((p == b) || ((p < e) && (*p != '.')))
+    return false;
+  if (p < e) {
+    const char* f = ++p;
+    for (; (p < e) && (*p >= '0') && (*p <= '9') && (p - f < 9); ++p, den *= 10)
+      num = 10 * num + (*p - '0');
+    if ((p == f) || (p < e))
+      return false;
+  }
+
+  const unsigned long long minutes = (120 * num + den) / (2 * den);
+  if ((minutes < 1) || (minutes > 255))
+    return false;
+
+  // Only accept the exact text print_csv() gives, so that it round-trips.
+  const std::string& text = hours_after_meal.text[minutes];
+  if (!equals(text, b, e))
+    return false;
+
+  tag2 = static_cast<unsigned char>(minutes);
+  return true;
+}
+
+bool contourpp::record::parse_csv_datetime(const char* b, const char* e)
+{
+  static const char no_datetime[] = "not-a-date-time";
+
+  if (e - b != 16) {
+    if ((e - b != sizeof(no_datetime) - 1) || std::memcmp(b, no_datetime, e - b))
+      return false;
+    minutes_ = no_minutes;
+    return true;
+  }
+
+  // YYYY-MM-DD HH:MM
+  unsigned c, y, month, day, hours, minutes;
+  if ((b[4] != '-') || (b[7] != '-') || (b[10] != ' ') || (b[13] != ':') ||
+    !parse_2digits(b, c) || !parse_2digits(b + 2, y) || !parse_2digits(b + 5, month) ||
+    !parse_2digits(b + 8, day) || !parse_2digits(b + 11, hours) ||
+    !parse_2digits(b + 14, minutes))
+    return false;
+
+  const long year = 100 * c + y;
+  if ((year < 1400) || (month < 1) || (month > 12) || (day < 1) ||
+    (day > last_day_of_month(year, month)) || (hours > 23) || (minutes > 59))
+    return false;
+
+  const long long m = static_cast<long long>(days_from_civil(year, month, day)) * minutes_per_day
+    + hours * 60 + minutes;
+  if (m > 2147483647LL)
+    return false;
+
+  minutes_ = static_cast<minutes_t>(m);
+  return true;
+}
+
+// The fields of a CSV record are: datetime, value, and then either the five
+// glucose tag fields and optionally the hours after meal, or the negative
+// type code of an insulin or carbs record. f are the nf separators in [b, e).
+bool contourpp::record::parse_csv_fields(const char* b, const char* const* f, size_t nf,
+  const char* e)
 {
   clear();
 
-  if ((e - b < 2) || (*b != field_sep))
+  if (((nf != 2) && (nf != 6) && (nf != 7)) || !parse_csv_datetime(b, f[0]))
     return false;
 
-  return false;
+  unsigned long value;
+  const char* value_end = f[1];
+  if ((value_end == f[0] + 1) || (value_end - f[0] > 6) ||
+    !parse_digits(f[0] + 1, value_end, e, value) || (value > 65535))
+    return false;
+  value_ = static_cast<unsigned short>(value);
+
+  if (nf == 2) { // insulin or carbs: -(1 + tag2)
+    unsigned long type;
+    if ((e - f[1] < 3) || (e - f[1] > 5) || (f[1][1] != '-') ||
+      !parse_digits(f[1] + 2, e, e, type) || (type < 1) || (type > 256))
+      return false;
+    tags_ = 128;
+    tag2_ = static_cast<unsigned char>(type - 1);
+    return true;
+  }
+
+  // Glucose: before (1) or after (2) food, then flags for don't feel right,
+  // sick, stress and activity.
+  static const unsigned char flags[] = { 8, 16, 32, 64 };
+  const char* fe = f[2];
+  if (fe - f[1] == 2) {
+    if (f[1][1] == '1') tags_ |= 2;
+    else if (f[1][1] == '2') tags_ |= 4;
+    else return false;
+  }
+  else if (fe - f[1] != 1)
+    return false;
+
+  for (size_t i = 0; i < 4; ++i) {
+    fe = (i + 3 < nf)? f[i + 3] : e;
+    if (fe - f[i + 2] == 2) {
+      if (f[i + 2][1] != '1')
+        return false;
+      tags_ |= flags[i];
+    }
+    else if (fe - f[i + 2] != 1)
+      return false;
+  }
+
+  return (nf == 6) || parse_after_meal(f[6] + 1, e, tag2_);
+}
+
+bool contourpp::record::parse_csv(const char* b, const char* e, char field_sep)
+{
+  const char* f[8];
+  size_t nf = 0;
+  for (const char* p = b; (nf < 8) && ((p = std::find(p, e, field_sep)) < e); ++p)
+    f[nf++] = p;
+  return parse_csv_fields(b, f, nf, e);
+}
+
+bool contourpp::record::parse_csv(const char* b, const char* e,
+  const unsigned int* seps, size_t nseps, const char* base)
+{
+  if (nseps > 7) {
+    clear();
+    return false;
+  }
+
+  const char* f[7];
+  for (size_t i = 0; i < nseps; ++i)
+    f[i] = base + seps[i];
+  return parse_csv_fields(b, f, nseps, e);
 }
 
 static inline const char* parse(const char* b, const char* e, std::string& s, char c)
@@ -258,6 +705,16 @@ bool contourpp::record_parser::parse_P(const char* b, const char* e)
   return ::parse(b + 1, e, patient_info_) <= e;
 }
 
+contourpp::meter_info contourpp::record_parser::info() const
+{
+  meter_info info;
+  info.product = product_;
+  info.versions = versions_;
+  info.serial = serial_;
+  info.sku = sku_;
+  return info;
+}
+
 bool contourpp::record_parser::parse(const char* b, const char* e, record& rec)
 {
   bool result = false;
@@ -278,30 +735,426 @@ bool contourpp::record_parser::parse(const char* b, const char* e, record& rec)
   return false;
 }
 
-void contourpp::record_parser::get_all(std::istream& is, std::vector<record>& records)
+namespace
 {
-  records.clear();
 
-  std::string buf;
-  record rec;
+// Collects parsed records and hands them to a record_visitor in batches.
+// Records are parsed in place into the next free slot.
+class record_batch
+{
+private:
+  static const size_t capacity = 256;
 
-  while (std::getline(is, buf))
+  contourpp::record records_[capacity];
+  size_t size_;
+  size_t total_;
+  contourpp::record_visitor& visitor_;
+
+public:
+  explicit record_batch(contourpp::record_visitor& visitor)
+    : size_(0), total_(0), visitor_(visitor) {}
+
+  contourpp::record& next() { return records_[size_]; }
+
+  void commit() {
+    if (++size_ == capacity)
+      flush();
+  }
+
+  // Pass a header on, after the records that precede it.
+  void header(const contourpp::meter_info& info) {
+    flush();
+    visitor_.header(info);
+  }
+
+  void flush() {
+    if (size_ > 0) {
+      const size_t n = size_;
+      size_ = 0;
+      total_ += n;
+      visitor_.visit(records_, records_ + n);
+    }
+  }
+
+  size_t total() const { return total_ + size_; }
+};
+
+} // namespace
+
+size_t contourpp::record_parser::parse_all(const char* b, const char* e,
+  std::vector<record>& records)
+{
+  record_appender appender(records);
+  return parse_lines(b, e, appender, NULL);
+}
+
+size_t contourpp::record_parser::parse_all(const char* b, const char* e,
+  record_visitor& visitor)
+{
+  return parse_lines(b, e, visitor, NULL);
+}
+
+size_t contourpp::record_parser::parse_lines(const char* b, const char* e,
+  record_visitor& visitor, std::vector<line_t>* others)
+{
+  static const size_t block_size = 1 << 20;
+  structural_index index;
+  record_batch batch(visitor);
+
+  while (b < e) {
+    // Index a block of whole lines at a time.
+    const char* block_end = e;
+    if (size_t(e - b) > block_size) {
+      block_end = static_cast<const char*>(::memchr(b + block_size, '\n', e - b - block_size));
+      block_end = block_end? (block_end + 1) : e;
+    }
+
+    const char chars[] = { field_sep_, '\n', 0 };
+    index.set_chars(chars);
+    index.scan(b, block_end);
+
+    const unsigned int *s = index.begin(), *se = index.end(), *ls;
+    const char *line = b, *eol;
+    bool restart = false;
+
+    for (; !restart && (line < block_end); line = eol + 1) {
+      for (ls = s; (s < se) && (b[*s] != '\n'); ++s)
+        ;
+      const size_t nseps = s - ls;
+      eol = (s < se)? (b + *(s++)) : block_end;
+
+      record& rec = batch.next();
+      if ((line < eol) && (*line == 'R') && rec.parse_bayer(line + 1, eol, ls, nseps, b)) {
+        batch.commit();
+        continue;
+      }
+
+      // Not an R record (or a malformed one, which parse() reports).
+      const char field_sep = field_sep_;
+      if (parse(line, eol, rec))
+        batch.commit();
+      else {
+        if (*line == 'H')
+          batch.header(info());
+        if (others)
+          others->push_back(line_t(line, eol));
+      }
+
+      // A header changed the delimiters; re-index from the next line.
+      restart = (field_sep_ != field_sep);
+    }
+
+    b = (line < block_end)? line : block_end;
+  }
+
+  batch.flush();
+  return batch.total();
+}
+
+namespace
+{
+
+// Records and headers of one chunk, kept in order until all chunks are
+// parsed.
+class chunk_result : public contourpp::record_visitor
+{
+private:
+  std::vector<contourpp::record> records_;
+  std::vector<std::pair<size_t, contourpp::meter_info> > headers_;
+
+public:
+  size_t size() const { return records_.size(); }
+
+  void clear() {
+    records_.clear();
+    headers_.clear();
+  }
+
+  void visit(const contourpp::record* b, const contourpp::record* e) {
+    records_.insert(records_.end(), b, e);
+  }
+
+  void header(const contourpp::meter_info& info) {
+    headers_.push_back(std::make_pair(records_.size(), info));
+  }
+
+  // Add n to the index of every record.
+  void renumber(size_t n) {
+    for (size_t i = 0; i < records_.size(); ++i)
+      records_[i].set_index(records_[i].index() + n);
+  }
+
+  void replay(contourpp::record_visitor& visitor) const {
+    const contourpp::record* r = records_.data();
+    for (size_t i = 0, done = 0; i <= headers_.size(); ++i) {
+      const size_t end = (i < headers_.size())? headers_[i].first : records_.size();
+      if (done < end)
+        visitor.visit(r + done, r + end);
+      if (i < headers_.size())
+        visitor.header(headers_[i].second);
+      done = end;
+    }
+  }
+};
+
+// Split [b, e) into newline-aligned chunks for jobs threads, returning the
+// number of chunks (bounds.size() - 1).
+size_t chunk_bounds(const char* b, const char* e, size_t jobs,
+  std::vector<const char*>& bounds)
+{
+  static const size_t min_chunk_size = 4 << 20;
+
+  const size_t size = e - b;
+  const size_t nchunks = (jobs > 1)? std::min(4 * jobs, size / min_chunk_size) : 1;
+
+  bounds.assign(1, b);
+  for (size_t i = 1; i < nchunks; ++i) {
+    const char* p = std::max(b + (size / nchunks) * i, bounds.back());
+    p = static_cast<const char*>(::memchr(p, '\n', e - p));
+    if (!p)
+      break;
+    if (p + 1 < e)
+      bounds.push_back(p + 1);
+  }
+  bounds.push_back(e);
+  return bounds.size() - 1;
+}
+
+// Parses one chunk of a CSV file, numbering its records from 1.
+struct csv_chunk_parser
+{
+  const std::vector<const char*>& bounds_;
+  std::vector<chunk_result>& records_;
+
+  csv_chunk_parser(const std::vector<const char*>& bounds,
+    std::vector<chunk_result>& records)
+    : bounds_(bounds), records_(records) {}
+
+  void operator()(size_t i)
   {
-    if (parse(buf.data(), buf.data() + buf.size(), rec))
-      records.push_back(rec);
+    contourpp::record_parser parser;
+    parser.parse_all_csv(bounds_[i], bounds_[i + 1], records_[i]);
   }
+};
+
+// Parses one chunk of a file with a speculative copy of the parser state.
+// Errors are kept per chunk, since they may be caused by a wrong guess.
+struct chunk_parser
+{
+  const std::vector<const char*>& bounds_;
+  std::vector<contourpp::record_parser>& parsers_;
+  std::vector<chunk_result>& records_;
+  std::vector<std::vector<contourpp::record_parser::line_t> >& others_;
+  std::vector<std::string>& errors_;
+
+  chunk_parser(const std::vector<const char*>& bounds,
+    std::vector<contourpp::record_parser>& parsers,
+    std::vector<chunk_result>& records,
+    std::vector<std::vector<contourpp::record_parser::line_t> >& others,
+    std::vector<std::string>& errors)
+    : bounds_(bounds), parsers_(parsers), records_(records), others_(others),
+    errors_(errors) {}
+
+  void operator()(size_t i)
+  {
+    try {
+      parsers_[i].parse_lines(bounds_[i], bounds_[i + 1], records_[i], &others_[i]);
+    }
+    catch (const std::exception& e) {
+      errors_[i] = e.what();
+      if (errors_[i].empty())
+        errors_[i] = "unknown error";
+    }
+  }
+};
+
+} // namespace
+
+size_t contourpp::record_parser::parse_all(const char* b, const char* e,
+  record_visitor& visitor, size_t jobs)
+{
+  std::vector<const char*> bounds;
+  const size_t nchunks = chunk_bounds(b, e, jobs, bounds);
+  if (nchunks <= 1)
+    return parse_all(b, e, visitor);
+
+  // Parse every chunk assuming that it starts with the current state; headers
+  // rarely change the delimiters, so the guess is almost always right.
+  std::vector<record_parser> parsers(nchunks, *this);
+  std::vector<chunk_result> results(nchunks);
+  std::vector<std::vector<line_t> > others(nchunks);
+  std::vector<std::string> errors(nchunks);
+  chunk_parser chunkparser(bounds, parsers, results, others, errors);
+  parallel_for(nchunks, jobs, chunkparser);
+
+  // Replay the non-record lines in order to carry the parser state across the
+  // chunks, and re-parse any chunk whose guessed delimiters were wrong.
+  const record_parser guess(*this);
+  for (size_t i = 0; i < nchunks; ++i) {
+    if (!same_delimiters(guess)) {
+      results[i].clear();
+      parse_all(bounds[i], bounds[i + 1], results[i]);
+      continue;
+    }
+
+    if (!errors[i].empty())
+      throw std::runtime_error(errors[i]);
+
+    record rec;
+    for (std::vector<line_t>::const_iterator l = others[i].begin(); l != others[i].end(); ++l)
+      parse(l->first, l->second, rec);
+  }
+
+  size_t total = 0;
+  for (size_t i = 0; i < nchunks; ++i) {
+    total += results[i].size();
+    results[i].replay(visitor);
+    results[i] = chunk_result();
+  }
+
+  return total;
 }
 
+void contourpp::record_parser::get_all(std::istream& is, std::vector<record>& records)
+{
+  records.clear();
+
+  record_appender appender(records);
+  get_all(is, appender);
+}
 
 void contourpp::record_parser::get_all(std::vector<record>& records)
 {
   records.clear();
 
+  record_appender appender(records);
+  get_all(appender);
+}
+
+void contourpp::record_parser::get_all(std::istream& is, record_visitor& visitor)
+{
+  std::string buf;
+  record_batch batch(visitor);
+
+  while (std::getline(is, buf))
+  {
+    if (parse(buf.data(), buf.data() + buf.size(), batch.next()))
+      batch.commit();
+    else if (buf[0] == 'H')
+      batch.header(info());
+  }
+
+  batch.flush();
+}
+
+void contourpp::record_parser::get_all(record_visitor& visitor)
+{
   interface device;
-  record rec;
+  record_batch batch(visitor);
   const char *begin = NULL, *end = NULL;
 
   while (device.sync(begin, end))
-    if (parse(begin, end, rec))
-      records.push_back(rec);
+    if (parse(begin, end, batch.next()))
+      batch.commit();
+    else if (*begin == 'H')
+      batch.header(info());
+
+  batch.flush();
+}
+
+bool contourpp::record_parser::is_csv(const char* b, const char* e)
+{
+  static const char no_datetime[] = "not-a-date-time,";
+  const size_t n = std::min(size_t(e - b), sizeof(no_datetime) - 1);
+  return (b < e) && (((*b >= '0') && (*b <= '9')) || !std::memcmp(b, no_datetime, n));
+}
+
+size_t contourpp::record_parser::parse_all_csv(const char* b, const char* e,
+  record_visitor& visitor)
+{
+  static const size_t block_size = 1 << 20;
+  structural_index index;
+  index.set_chars(",\n");
+  record_batch batch(visitor);
+
+  while (b < e) {
+    // Index a block of whole lines at a time.
+    const char* block_end = e;
+    if (size_t(e - b) > block_size) {
+      block_end = static_cast<const char*>(::memchr(b + block_size, '\n', e - b - block_size));
+      block_end = block_end? (block_end + 1) : e;
+    }
+
+    index.scan(b, block_end);
+
+    const unsigned int *s = index.begin(), *se = index.end(), *ls;
+    for (const char *line = b, *eol; line < block_end; line = eol + 1) {
+      for (ls = s; (s < se) && (b[*s] != '\n'); ++s)
+        ;
+      const size_t nseps = s - ls;
+      eol = (s < se)? (b + *(s++)) : block_end;
+
+      const char* end = ((line < eol) && (eol[-1] == '\r'))? (eol - 1) : eol;
+      if (line == end)
+        continue;
+
+      record& rec = batch.next();
+      if (!rec.parse_csv(line, end, ls, nseps, b))
+        throw std::runtime_error(contourpp::interface::to_string(line, end, "Can't parse CSV record: "));
+      rec.set_index(++csv_count_);
+      batch.commit();
+    }
+
+    b = block_end;
+  }
+
+  batch.flush();
+  return batch.total();
+}
+
+size_t contourpp::record_parser::parse_all_csv(const char* b, const char* e,
+  record_visitor& visitor, size_t jobs)
+{
+  std::vector<const char*> bounds;
+  const size_t nchunks = chunk_bounds(b, e, jobs, bounds);
+  if (nchunks <= 1)
+    return parse_all_csv(b, e, visitor);
+
+  std::vector<chunk_result> results(nchunks);
+  csv_chunk_parser chunkparser(bounds, results);
+  parallel_for(nchunks, jobs, chunkparser);
+
+  size_t total = 0;
+  for (size_t i = 0; i < nchunks; ++i) {
+    results[i].renumber(csv_count_ + total);
+    total += results[i].size();
+    results[i].replay(visitor);
+    results[i] = chunk_result();
+  }
+
+  csv_count_ += total;
+  return total;
+}
+
+void contourpp::record_parser::get_all_csv(std::istream& is, record_visitor& visitor)
+{
+  std::string buf;
+  record_batch batch(visitor);
+
+  while (std::getline(is, buf))
+  {
+    if (!buf.empty() && (buf[buf.size() - 1] == '\r'))
+      buf.erase(buf.size() - 1);
+    if (buf.empty())
+      continue;
+
+    record& rec = batch.next();
+    if (!rec.parse_csv(buf.data(), buf.data() + buf.size()))
+      throw std::runtime_error(contourpp::interface::to_string(buf.data(),
+        buf.data() + buf.size(), "Can't parse CSV record: "));
+    rec.set_index(++csv_count_);
+    batch.commit();
+  }
+
+  batch.flush();
 }
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <cmath>
+#include "contourpp_formatter.hpp"
+
+using namespace contourpp;
+
+record_formatter::record_formatter(std::ostream& os, size_t buffer_size)
+  : os_(os), buf_(std::max(buffer_size, 2 * (record::max_text_size + 1))), size_(0)
+{
+}
+
+void record_formatter::flush()
+{
+  if (size_) {
+    os_.write(&buf_[0], size_);
+    size_ = 0;
+  }
+  os_.flush();
+}
+
+// Writes v to p rounded to one decimal.
+static char* put_decimal(char* p, double v)
+{
+  const double tenths = std::floor(std::fabs(v) * 10 + 0.5);
+  if ((v < 0) && (tenths > 0))
+    *p++ = '-';
+
+  char digits[24];
+  char* d = digits + sizeof(digits);
+  unsigned long long t = static_cast<unsigned long long>(tenths);
+  *--d = static_cast<char>('0' + t % 10);
+  *--d = '.';
+  t /= 10;
+  do {
+    *--d = static_cast<char>('0' + t % 10);
+    t /= 10;
+  } while (t);
+  return std::copy(d, digits + sizeof(digits), p);
+}
+
+static char* put_uint(char* p, unsigned long long v)
+{
+  char digits[24];
+  char* d = digits + sizeof(digits);
+  do {
+    *--d = static_cast<char>('0' + v % 10);
+    v /= 10;
+  } while (v);
+  return std::copy(d, digits + sizeof(digits), p);
+}
+
+void record_formatter::csv(const record& rec, const rolling_stats* stats, size_t n,
+  char field_sep)
+{
+  static const size_t stats_text_size = 96;
+  char* p = rec.format_csv(reserve(record::max_text_size + n * stats_text_size), field_sep,
+    &dates_);
+  if (!rec.is_glucose()) {
+    commit(p);
+    return;
+  }
+
+  if (!rec.tag2())
+    *p++ = field_sep;
+  for (size_t i = 0; i < n; ++i) {
+    const rolling_stats& s = stats[i];
+    if (!s.count) { // not in any window
+      p = std::fill_n(p, 6, field_sep);
+      continue;
+    }
+
+    *p++ = field_sep;
+    p = put_uint(p, s.count);
+    *p++ = field_sep;
+    p = put_decimal(p, s.mean);
+    *p++ = field_sep;
+    p = put_decimal(p, s.sd);
+    *p++ = field_sep;
+    p = put_uint(p, s.min);
+    *p++ = field_sep;
+    p = put_uint(p, s.max);
+    *p++ = field_sep;
+    if (s.has_rate)
+      p = put_decimal(p, s.rate);
+  }
+  commit(p);
+}
@@ -0,0 +1,107 @@
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "contourpp_mapped_file.hpp"
+
+using namespace contourpp;
+
+static inline std::runtime_error file_error(const char* what, const char* filename)
+{
+  return std::runtime_error(std::string(what) + " '" + filename + "': " + ::strerror(errno));
+}
+
+bool mapped_file::map(int fd)
+{
+  struct stat st;
+  if ((::fstat(fd, &st) != 0) || !S_ISREG(st.st_mode) || (st.st_size <= 0))
+    return false;
+
+  void* p = ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED)
+    return false;
+
+#if defined(POSIX_MADV_SEQUENTIAL)
+  ::posix_madvise(p, st.st_size, POSIX_MADV_SEQUENTIAL);
+  ::posix_madvise(p, st.st_size, POSIX_MADV_WILLNEED);
+#elif defined(MADV_SEQUENTIAL)
+  ::madvise(p, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+  map_ = p;
+  map_size_ = st.st_size;
+  begin_ = static_cast<const char*>(p);
+  end_ = begin_ + map_size_;
+  return true;
+}
+
+void mapped_file::read(int fd, const char* filename)
+{
+  static const size_t chunk = 1 << 16;
+  size_t n = 0;
+
+  buffer_.clear();
+  for (;;) {
+    buffer_.resize(n + chunk);
+    ssize_t r = ::read(fd, buffer_.data() + n, chunk);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      throw file_error("could not read", filename);
+    }
+    if (r == 0)
+      break;
+    n += r;
+  }
+
+  buffer_.resize(n);
+  begin_ = buffer_.data();
+  end_ = begin_ + n;
+}
+
+bool mapped_file::open(const char* filename)
+{
+  if (open_)
+    return false;
+
+  const bool use_stdin = (filename[0] == '-') && (filename[1] == 0);
+  int fd = use_stdin? STDIN_FILENO : ::open(filename, O_RDONLY);
+  if (fd < 0)
+    throw file_error("could not open", filename);
+
+  try {
+    if (!map(fd))
+      read(fd, filename);
+  }
+  catch (...) {
+    if (!use_stdin)
+      ::close(fd);
+    throw;
+  }
+
+  if (!use_stdin)
+    ::close(fd);
+
+  open_ = true;
+  return true;
+}
+
+bool mapped_file::close()
+{
+  if (!open_)
+    return false;
+
+  if (map_)
+    ::munmap(map_, map_size_);
+
+  std::vector<char>().swap(buffer_);
+  map_ = NULL;
+  map_size_ = 0;
+  begin_ = end_ = NULL;
+  open_ = false;
+  return true;
+}
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include "contourpp_merge.hpp"
+
+using namespace contourpp;
+
+bool record_source::refill()
+{
+  // Keep the meter of the records read so far, for a batch without headers.
+  batch_.clear();
+  headers_.clear();
+  next_ = next_header_ = 0;
+
+  while (batch_.empty())
+    if (!fill())
+      return false;
+  return true;
+}
+
+bool text_source::fill()
+{
+  if (p_ >= e_)
+    return false;
+
+  // A chunk of whole lines.
+  const char* end = e_;
+  if (size_t(e_ - p_) > chunk_size) {
+    end = static_cast<const char*>(std::memchr(p_ + chunk_size, '\n', e_ - p_ - chunk_size));
+    end = end? (end + 1) : e_;
+  }
+
+  if (csv_)
+    parser_.parse_all_csv(p_, end, *this);
+  else
+    parser_.parse_all(p_, end, *this);
+  p_ = end;
+  return true;
+}
+
+bool archive_source::fill()
+{
+  for (;;) {
+    if (!in_segment_) {
+      if (!reader_.next_segment())
+        return false;
+      header(reader_.info());
+      in_segment_ = true;
+    }
+
+    block_.clear();
+    if (reader_.next_block(block_)) {
+      block_.replay(0, block_.size(), *this);
+      return true;
+    }
+    in_segment_ = false;
+  }
+}
+
+namespace
+{
+
+// The next record of a source, by time, then index (or 0), then source.
+struct merge_key
+{
+  minutes_t minutes;
+  boost::uint32_t index;
+  size_t source;
+
+  merge_key(const record& rec, bool by_index, size_t i)
+    : minutes(rec.minutes()), index(by_index? static_cast<boost::uint32_t>(rec.index()) : 0),
+      source(i) {}
+
+  bool operator>(const merge_key& o) const {
+    if (minutes != o.minutes)
+      return minutes > o.minutes;
+    if (index != o.index)
+      return index > o.index;
+    return source > o.source;
+  }
+};
+
+} // namespace
+
+void contourpp::merge_records(const std::vector<record_source*>& sources,
+  record_visitor& visitor, bool by_index)
+{
+  static const size_t batch_size = 256;
+
+  std::priority_queue<merge_key, std::vector<merge_key>, std::greater<merge_key> > heap;
+  for (size_t i = 0; i < sources.size(); ++i)
+    if (const record* rec = sources[i]->peek())
+      heap.push(merge_key(*rec, by_index, i));
+
+  std::vector<record> batch;
+  batch.reserve(batch_size);
+  meter_info info;
+
+  while (!heap.empty()) {
+    const size_t i = heap.top().source;
+    record_source& source = *sources[i];
+    heap.pop();
+
+    const record rec = *source.peek();
+    if (!(source.info() == info)) {
+      if (!batch.empty())
+        visitor.visit(batch.data(), batch.data() + batch.size());
+      batch.clear();
+      visitor.header(info = source.info());
+    }
+
+    batch.push_back(rec);
+    if (batch.size() == batch_size) {
+      visitor.visit(batch.data(), batch.data() + batch.size());
+      batch.clear();
+    }
+
+    source.pop();
+    if (const record* next = source.peek())
+      heap.push(merge_key(*next, by_index, i));
+  }
+
+  if (!batch.empty())
+    visitor.visit(batch.data(), batch.data() + batch.size());
+}
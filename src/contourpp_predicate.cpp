@@ -0,0 +1,349 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include "contourpp_predicate.hpp"
+
+using namespace contourpp;
+
+static const char* const field_names[] = {
+  "value", "index", "year", "month", "day", "weekday", "hour", "minute",
+  "meal_minutes"
+};
+
+static const char* const flag_names[] = {
+  "glucose", "insulin_short", "insulin_long", "carbs", "after_meal", "control",
+  "before_food", "after_food", "dont_feel_right", "sick", "stress", "activity"
+};
+
+template <size_t N>
+static int find_name(const char* const (&names)[N], const std::string& name)
+{
+  for (size_t i = 0; i < N; ++i)
+    if (name == names[i])
+      return static_cast<int>(i);
+  return -1;
+}
+
+// Recursive descent parser, emitting the program in postfix order.
+class record_predicate::compiler
+{
+private:
+  const std::string& s_;
+  size_t p_;
+  std::vector<instruction>& code_;
+  size_t depth_, max_depth_;
+
+  void fail(const char* expected) const {
+    throw std::runtime_error("Invalid predicate: expected " + std::string(expected) +
+      " at '" + s_.substr(p_) + "'");
+  }
+
+  void skip_space() {
+    while ((p_ < s_.size()) && std::isspace(static_cast<unsigned char>(s_[p_])))
+      ++p_;
+  }
+
+  static bool is_word_char(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || (c == '_');
+  }
+
+  bool accept(const char* token) {
+    skip_space();
+    const size_t n = std::strlen(token);
+    if (s_.compare(p_, n, token) != 0)
+      return false;
+    if (is_word_char(token[0]) && (p_ + n < s_.size()) && is_word_char(s_[p_ + n]))
+      return false; // only a prefix of a longer word
+    p_ += n;
+    return true;
+  }
+
+  std::string word() {
+    skip_space();
+    const size_t b = p_;
+    while ((p_ < s_.size()) && is_word_char(s_[p_]))
+      ++p_;
+    return s_.substr(b, p_ - b);
+  }
+
+  long number() {
+    skip_space();
+    const char* b = s_.c_str() + p_;
+    char* e = NULL;
+    const long n = std::strtol(b, &e, 10);
+    if (e == b)
+      fail("a number");
+    p_ += e - b;
+    return n;
+  }
+
+  void emit(const instruction& i) {
+    code_.push_back(i);
+    if ((i.op == op_and) || (i.op == op_or))
+      --depth_;
+    else if (i.op != op_not)
+      max_depth_ = std::max(max_depth_, ++depth_);
+  }
+
+  void parse_or() {
+    parse_and();
+    while (accept("||") || accept("or")) {
+      parse_and();
+      emit(instruction(op_or));
+    }
+  }
+
+  void parse_and() {
+    parse_not();
+    while (accept("&&") || accept("and")) {
+      parse_not();
+      emit(instruction(op_and));
+    }
+  }
+
+  void parse_not() {
+    // "!", but not the start of "!=".
+    skip_space();
+    if (accept("not") || ((s_.compare(p_, 2, "!=") != 0) && accept("!"))) {
+      parse_not();
+      emit(instruction(op_not));
+    }
+    else
+      parse_primary();
+  }
+
+  void parse_primary() {
+    if (accept("(")) {
+      parse_or();
+      if (!accept(")"))
+        fail("')'");
+      return;
+    }
+
+    const size_t start = p_;
+    const std::string name = word();
+    const int flag = find_name(flag_names, name);
+    if (flag >= 0) {
+      emit(instruction(op_flag, flag));
+      return;
+    }
+
+    const int field = find_name(field_names, name);
+    if (field < 0) {
+      p_ = start;
+      fail("a field or flag");
+    }
+
+    if (accept("between")) {
+      const long a = number();
+      if (!accept("and"))
+        fail("'and'");
+      emit(instruction(op_between, field, a, number()));
+      return;
+    }
+
+    opcode_t op;
+    if (accept("<=")) op = op_le;
+    else if (accept(">=")) op = op_ge;
+    else if (accept("<")) op = op_lt;
+    else if (accept(">")) op = op_gt;
+    else if (accept("==") || accept("=")) op = op_eq;
+    else if (accept("!=")) op = op_ne;
+    else { fail("a comparison or 'between'"); return; }
+
+    emit(instruction(op, field, number()));
+  }
+
+public:
+  compiler(const std::string& s, std::vector<instruction>& code)
+    : s_(s), p_(0), code_(code), depth_(0), max_depth_(0) {}
+
+  size_t compile() {
+    parse_or();
+    skip_space();
+    if (p_ < s_.size())
+      fail("an operator");
+    return max_depth_;
+  }
+};
+
+const size_t record_predicate::batch_size;
+
+record_predicate::record_predicate(const std::string& expression)
+  : depth_(0)
+{
+  compiler c(expression, code_);
+  depth_ = c.compile();
+}
+
+// Columns of up to batch_size records, and the fields computed from them.
+struct record_predicate::batch
+{
+  size_t size;
+  minutes_t minutes[batch_size];
+  boost::uint32_t index[batch_size];
+  unsigned short value[batch_size];
+  unsigned char tags[batch_size], tag2[batch_size];
+
+  boost::int32_t fields[field_count][batch_size];
+  bool ready[field_count];
+
+  void reset(size_t n) {
+    size = n;
+    std::fill(ready, ready + field_count, false);
+  }
+
+  void gather(const record& rec, size_t i) {
+    minutes[i] = rec.minutes();
+    index[i] = static_cast<boost::uint32_t>(rec.index());
+    value[i] = rec.value();
+    tags[i] = rec.tags();
+    tag2[i] = rec.tag2();
+  }
+
+  const boost::int32_t* field(int f) {
+    if (ready[f])
+      return fields[f];
+
+    switch (f) {
+      case field_value:
+        std::copy(value, value + size, fields[f]);
+        break;
+      case field_index:
+        for (size_t i = 0; i < size; ++i)
+          fields[f][i] = static_cast<boost::int32_t>(index[i]);
+        break;
+      case field_meal_minutes:
+        for (size_t i = 0; i < size; ++i)
+          fields[f][i] = (tags[i] & 128)? 0 : tag2[i];
+        break;
+      case field_hour:
+      case field_minute:
+        for (size_t i = 0; i < size; ++i) {
+          const long m = minutes[i] - floor_div(minutes[i], minutes_per_day) * minutes_per_day;
+          fields[field_hour][i] = static_cast<boost::int32_t>(m / 60);
+          fields[field_minute][i] = static_cast<boost::int32_t>(m % 60);
+        }
+        ready[field_hour] = ready[field_minute] = true;
+        break;
+      default: // calendar fields
+        for (size_t i = 0; i < size; ++i) {
+          const long days = floor_div(minutes[i], minutes_per_day);
+          long y;
+          unsigned m, d;
+          civil_from_days(days, y, m, d);
+          fields[field_year][i] = static_cast<boost::int32_t>(y);
+          fields[field_month][i] = m;
+          fields[field_day][i] = d;
+          fields[field_weekday][i] = static_cast<boost::int32_t>(days + 4 - floor_div(days + 4, 7) * 7);
+        }
+        ready[field_year] = ready[field_month] = ready[field_day] = ready[field_weekday] = true;
+    }
+
+    ready[f] = true;
+    return fields[f];
+  }
+};
+
+static inline bool has_flag(int flag, unsigned char t, unsigned char t2)
+{
+  switch (flag) {
+    case record_predicate::flag_glucose:       return (t & 128) == 0;
+    case record_predicate::flag_insulin_short: return (t & 128) && (t2 == 0);
+    case record_predicate::flag_insulin_long:  return (t & 128) && (t2 == 1);
+    case record_predicate::flag_carbs:         return (t & 128) && (t2 == 2);
+    case record_predicate::flag_after_meal:    return ((t & 128) == 0) && (t2 != 0);
+    default: // glucose tags, in the order of their bits
+      return ((t & 128) == 0) && (t & (1 << (flag - record_predicate::flag_control)));
+  }
+}
+
+void record_predicate::run(batch& in, unsigned char* match) const
+{
+  const size_t n = in.size;
+  std::vector<unsigned char> stack(std::max<size_t>(depth_, 1) * batch_size);
+  size_t sp = 0; // number of results on the stack
+  unsigned char* top = NULL;
+
+  for (std::vector<instruction>::const_iterator c = code_.begin(); c != code_.end(); ++c) {
+    if ((c->op == op_and) || (c->op == op_or)) {
+      unsigned char* r = top;
+      top = &stack[(--sp - 1) * batch_size];
+      if (c->op == op_and)
+        for (size_t i = 0; i < n; ++i) top[i] &= r[i];
+      else
+        for (size_t i = 0; i < n; ++i) top[i] |= r[i];
+      continue;
+    }
+
+    if (c->op == op_not) {
+      for (size_t i = 0; i < n; ++i) top[i] ^= 1;
+      continue;
+    }
+
+    top = &stack[sp++ * batch_size];
+    if (c->op == op_flag) {
+      for (size_t i = 0; i < n; ++i)
+        top[i] = has_flag(c->arg, in.tags[i], in.tag2[i]);
+      continue;
+    }
+
+    const boost::int32_t* f = in.field(c->arg);
+    const long a = c->a, b = c->b;
+    switch (c->op) {
+      case op_lt: for (size_t i = 0; i < n; ++i) top[i] = (f[i] < a); break;
+      case op_le: for (size_t i = 0; i < n; ++i) top[i] = (f[i] <= a); break;
+      case op_gt: for (size_t i = 0; i < n; ++i) top[i] = (f[i] > a); break;
+      case op_ge: for (size_t i = 0; i < n; ++i) top[i] = (f[i] >= a); break;
+      case op_eq: for (size_t i = 0; i < n; ++i) top[i] = (f[i] == a); break;
+      case op_ne: for (size_t i = 0; i < n; ++i) top[i] = (f[i] != a); break;
+      default:
+        if (a <= b)
+          for (size_t i = 0; i < n; ++i) top[i] = (f[i] >= a) & (f[i] <= b);
+        else // wraps around, e.g. hours 22 to 6
+          for (size_t i = 0; i < n; ++i) top[i] = (f[i] >= a) | (f[i] <= b);
+    }
+  }
+
+  std::copy(stack.begin(), stack.begin() + n, match);
+}
+
+void record_predicate::filter(const record_table& table,
+  std::vector<record_table::row_t>& rows) const
+{
+  std::vector<batch> in(1);
+  unsigned char match[batch_size];
+  size_t out = 0;
+
+  for (size_t b = 0; b < rows.size(); b += batch_size) {
+    const size_t n = std::min(batch_size, rows.size() - b);
+    in[0].reset(n);
+    for (size_t i = 0; i < n; ++i)
+      in[0].gather(table[rows[b + i]], i);
+
+    run(in[0], match);
+    for (size_t i = 0; i < n; ++i)
+      if (match[i])
+        rows[out++] = rows[b + i];
+  }
+
+  rows.resize(out);
+}
+
+void record_predicate::evaluate(const record* b, const record* e, unsigned char* match) const
+{
+  std::vector<batch> in(1);
+
+  for (; b < e; ) {
+    const size_t n = std::min(batch_size, size_t(e - b));
+    in[0].reset(n);
+    for (size_t i = 0; i < n; ++i)
+      in[0].gather(b[i], i);
+
+    run(in[0], match);
+    b += n;
+    match += n;
+  }
+}
@@ -0,0 +1,279 @@
+#include <algorithm>
+#include "contourpp_record_table.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace contourpp;
+
+void record_table::clear()
+{
+  minutes_.clear();
+  indices_.clear();
+  values_.clear();
+  tags_.clear();
+  tag2_.clear();
+  meter_ids_.clear();
+  meters_.assign(1, meter_info());
+  meter_ = 0;
+}
+
+void record_table::reserve(size_t n)
+{
+  minutes_.reserve(n);
+  indices_.reserve(n);
+  values_.reserve(n);
+  tags_.reserve(n);
+  tag2_.reserve(n);
+  meter_ids_.reserve(n);
+}
+
+void record_table::push_back(const record& rec)
+{
+  minutes_.push_back(rec.minutes());
+  indices_.push_back(static_cast<boost::uint32_t>(rec.index()));
+  values_.push_back(rec.value());
+  tags_.push_back(rec.tags());
+  tag2_.push_back(rec.tag2());
+  meter_ids_.push_back(meter_);
+}
+
+void record_table::header(const meter_info& info)
+{
+  if (meters_[meter_] == info)
+    return;
+
+  meter_ = static_cast<meter_t>(meters_.size());
+  meters_.push_back(info);
+}
+
+size_t record_table::grow(size_t m)
+{
+  const size_t n = size();
+  if (minutes_.capacity() < n + m)
+    reserve(std::max(2 * minutes_.capacity(), n + m));
+
+  minutes_.resize(n + m);
+  indices_.resize(n + m);
+  values_.resize(n + m);
+  tags_.resize(n + m);
+  tag2_.resize(n + m);
+  meter_ids_.resize(n + m, meter_);
+  return n;
+}
+
+void record_table::append(const record* b, const record* e)
+{
+  for (size_t i = grow(e - b); b != e; ++b, ++i) {
+    minutes_[i] = b->minutes();
+    indices_[i] = static_cast<boost::uint32_t>(b->index());
+    values_[i] = b->value();
+    tags_[i] = b->tags();
+    tag2_[i] = b->tag2();
+  }
+}
+
+void record_table::append(const record_table& o)
+{
+  minutes_.insert(minutes_.end(), o.minutes_.begin(), o.minutes_.end());
+  indices_.insert(indices_.end(), o.indices_.begin(), o.indices_.end());
+  values_.insert(values_.end(), o.values_.begin(), o.values_.end());
+  tags_.insert(tags_.end(), o.tags_.begin(), o.tags_.end());
+  tag2_.insert(tag2_.end(), o.tag2_.begin(), o.tag2_.end());
+
+  // Meters of o come after ours, except for meter 0.
+  const meter_t base = static_cast<meter_t>(meters_.size()) - 1;
+  const size_t n = meter_ids_.size();
+  meter_ids_.insert(meter_ids_.end(), o.meter_ids_.begin(), o.meter_ids_.end());
+  for (size_t i = n; i < meter_ids_.size(); ++i)
+    if (meter_ids_[i])
+      meter_ids_[i] += base;
+
+  meters_.insert(meters_.end(), o.meters_.begin() + 1, o.meters_.end());
+  meter_ = o.meter_? (o.meter_ + base) : 0;
+}
+
+void record_table::replay(size_t b, size_t e, record_visitor& visitor) const
+{
+  static const size_t batch_size = 256;
+  record batch[batch_size];
+  meter_t meter = 0;
+
+  while (b < e) {
+    if (meter_ids_[b] != meter)
+      visitor.header(meters_[meter = meter_ids_[b]]);
+
+    size_t n = 0;
+    for (; (n < batch_size) && (b + n < e) && (meter_ids_[b + n] == meter); ++n)
+      batch[n] = (*this)[b + n];
+    visitor.visit(batch, batch + n);
+    b += n;
+  }
+}
+
+void record_table::shift_minutes(minutes_t m)
+{
+  minutes_t* t = minutes_.data();
+  for (size_t i = 0, n = size(); i < n; ++i)
+    t[i] += m;
+}
+
+namespace
+{
+
+// Record type predicates for select_rows(): each tests a record by its tags
+// and tag2, one at a time or (with SSE2) 16 at a time, giving 0xFF for the
+// selected bytes.
+
+// Any type in a mask of record::type_bits.
+struct type_in_mask
+{
+  unsigned char mask_;
+
+  explicit type_in_mask(unsigned char mask) : mask_(mask) {}
+
+  bool operator()(unsigned char t, unsigned char t2) const {
+    return (record::type(t, t2) & mask_) != 0;
+  }
+
+#if defined(__SSE2__)
+  __m128i operator()(__m128i t, __m128i t2) const {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i insulin = _mm_cmplt_epi8(t, zero); // tags & 128
+    const __m128i t2_0 = _mm_cmpeq_epi8(t2, zero);
+    const __m128i t2_1 = _mm_cmpeq_epi8(t2, _mm_set1_epi8(1));
+    const __m128i t2_2 = _mm_cmpeq_epi8(t2, _mm_set1_epi8(2));
+
+    const __m128i glucose_type = _mm_or_si128(_mm_set1_epi8(record::type_glucose),
+      _mm_andnot_si128(t2_0, _mm_set1_epi8(record::type_after_meal)));
+    const __m128i insulin_type = _mm_or_si128(
+      _mm_or_si128(_mm_and_si128(t2_0, _mm_set1_epi8(record::type_insulin_short)),
+        _mm_and_si128(t2_1, _mm_set1_epi8(record::type_insulin_long))),
+      _mm_or_si128(_mm_and_si128(t2_2, _mm_set1_epi8(record::type_carbs)),
+        _mm_andnot_si128(_mm_or_si128(_mm_or_si128(t2_0, t2_1), t2_2),
+          _mm_set1_epi8(static_cast<char>(record::type_unknown)))));
+
+    const __m128i type = _mm_or_si128(_mm_and_si128(insulin, insulin_type),
+      _mm_andnot_si128(insulin, glucose_type));
+    const __m128i none = _mm_cmpeq_epi8(_mm_and_si128(type,
+      _mm_set1_epi8(static_cast<char>(mask_))), zero);
+    return _mm_xor_si128(none, _mm_set1_epi8(-1));
+  }
+#endif
+};
+
+// Glucose readings (-g).
+struct is_glucose
+{
+  bool operator()(unsigned char t, unsigned char) const {
+    return (t & 128) == 0;
+  }
+
+#if defined(__SSE2__)
+  __m128i operator()(__m128i t, __m128i) const {
+    return _mm_cmpgt_epi8(t, _mm_set1_epi8(-1));
+  }
+#endif
+};
+
+// Glucose readings with after meal hours (-a).
+struct is_after_meal
+{
+  bool operator()(unsigned char t, unsigned char t2) const {
+    return ((t & 128) == 0) && (t2 != 0);
+  }
+
+#if defined(__SSE2__)
+  __m128i operator()(__m128i t, __m128i t2) const {
+    return _mm_andnot_si128(_mm_cmpeq_epi8(t2, _mm_setzero_si128()),
+      _mm_cmpgt_epi8(t, _mm_set1_epi8(-1)));
+  }
+#endif
+};
+
+// Insulin or carbs records of one kind (-i, -I, -c), by their tag2.
+struct is_insulin
+{
+  unsigned char tag2_;
+
+  explicit is_insulin(unsigned char tag2) : tag2_(tag2) {}
+
+  bool operator()(unsigned char t, unsigned char t2) const {
+    return (t & 128) && (t2 == tag2_);
+  }
+
+#if defined(__SSE2__)
+  __m128i operator()(__m128i t, __m128i t2) const {
+    return _mm_and_si128(_mm_cmplt_epi8(t, _mm_setzero_si128()),
+      _mm_cmpeq_epi8(t2, _mm_set1_epi8(static_cast<char>(tag2_))));
+  }
+#endif
+};
+
+// Append to rows the rows i < n for which pred(t[i], t2[i]) holds.
+template <typename Pred>
+void select_rows(const unsigned char* t, const unsigned char* t2, size_t n,
+  const Pred& pred, std::vector<record_table::row_t>& rows)
+{
+  const size_t first = rows.size();
+  rows.resize(first + n);
+  record_table::row_t* out = rows.data() + first;
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  for (; i + 16 <= n; i += 16) {
+    const __m128i vt = _mm_loadu_si128(reinterpret_cast<const __m128i*>(t + i));
+    const __m128i vt2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(t2 + i));
+    unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(pred(vt, vt2)));
+    while (mask) {
+      *out++ = static_cast<record_table::row_t>(i + __builtin_ctz(mask));
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for (; i < n; ++i)
+    if (pred(t[i], t2[i]))
+      *out++ = static_cast<record_table::row_t>(i);
+
+  rows.resize(out - rows.data());
+}
+
+} // namespace
+
+void record_table::select(unsigned char mask, std::vector<row_t>& rows) const
+{
+  static const unsigned char all_types = record::type_glucose | record::type_insulin_short |
+    record::type_insulin_long | record::type_carbs | record::type_unknown;
+
+  const unsigned char *t = tags_.data(), *t2 = tag2_.data();
+  const size_t n = size();
+
+  switch (mask) {
+    case record::type_glucose:
+      select_rows(t, t2, n, is_glucose(), rows);
+      break;
+    case record::type_after_meal:
+      select_rows(t, t2, n, is_after_meal(), rows);
+      break;
+    case record::type_insulin_short:
+      select_rows(t, t2, n, is_insulin(0), rows);
+      break;
+    case record::type_insulin_long:
+      select_rows(t, t2, n, is_insulin(1), rows);
+      break;
+    case record::type_carbs:
+      select_rows(t, t2, n, is_insulin(2), rows);
+      break;
+    default:
+      if ((mask & all_types) == all_types) { // every record
+        const size_t first = rows.size();
+        rows.resize(first + n);
+        for (size_t i = 0; i < n; ++i)
+          rows[first + i] = static_cast<row_t>(i);
+      }
+      else
+        select_rows(t, t2, n, type_in_mask(mask), rows);
+  }
+}
@@ -0,0 +1,62 @@
+#include <cmath>
+#include "contourpp_rolling.hpp"
+
+using namespace contourpp;
+
+rolling_window::rolling_window(minutes_t width)
+  : width_(width), sum_(0), sum2_(0)
+{
+}
+
+void rolling_window::clear()
+{
+  window_.clear();
+  mins_.clear();
+  maxs_.clear();
+  sum_ = sum2_ = 0;
+}
+
+rolling_stats rolling_window::add(minutes_t minutes, unsigned short value)
+{
+  if (!window_.empty() && (minutes < window_.back().minutes))
+    clear();
+
+  // Drop the values that are width_ or more minutes old.
+  while (!window_.empty() && (minutes - window_.front().minutes >= width_)) {
+    const sample& s = window_.front();
+    sum_ -= s.value;
+    sum2_ -= boost::uint64_t(s.value) * s.value;
+    if (mins_.front().minutes == s.minutes && mins_.front().value == s.value)
+      mins_.pop_front();
+    if (maxs_.front().minutes == s.minutes && maxs_.front().value == s.value)
+      maxs_.pop_front();
+    window_.pop_front();
+  }
+
+  const sample added(minutes, value);
+  window_.push_back(added);
+  sum_ += value;
+  sum2_ += boost::uint64_t(value) * value;
+  while (!mins_.empty() && (mins_.back().value > value))
+    mins_.pop_back();
+  mins_.push_back(added);
+  while (!maxs_.empty() && (maxs_.back().value < value))
+    maxs_.pop_back();
+  maxs_.push_back(added);
+
+  rolling_stats stats;
+  stats.count = window_.size();
+  stats.mean = double(sum_) / stats.count;
+  const double variance = double(sum2_) / stats.count - stats.mean * stats.mean;
+  stats.sd = (variance > 0)? std::sqrt(variance) : 0;
+  stats.min = mins_.front().value;
+  stats.max = maxs_.front().value;
+
+  const sample& oldest = window_.front();
+  if (oldest.minutes != minutes) {
+    stats.rate = (double(value) - oldest.value) * 60 / (minutes - oldest.minutes);
+    stats.has_rate = true;
+  }
+
+  return stats;
+}
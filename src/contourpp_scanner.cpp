@@ -0,0 +1,78 @@
+#include <cstring>
+#include "contourpp_scanner.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace contourpp;
+
+void structural_index::set_chars(const char* chars)
+{
+  nchars_ = 0;
+  for (; *chars && (nchars_ < max_chars); ++chars)
+    chars_[nchars_++] = *chars;
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+// Append the offsets of the set bits of mask (relative to base) to out.
+static inline unsigned int* flatten(unsigned int* out, unsigned int base, unsigned int mask)
+{
+  while (mask) {
+    *out++ = base + __builtin_ctz(mask);
+    mask &= mask - 1;
+  }
+  return out;
+}
+#endif
+
+void structural_index::scan(const char* b, const char* e)
+{
+  const size_t n = e - b;
+  if (offsets_.size() < n)
+    offsets_.resize(n);
+
+  unsigned int* out = offsets_.data();
+  size_t i = 0;
+
+#if defined(__AVX2__)
+  __m256i c[max_chars];
+  for (size_t k = 0; k < nchars_; ++k)
+    c[k] = _mm256_set1_epi8(chars_[k]);
+
+  for (; i + 32 <= n; i += 32) {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    __m256i m = _mm256_setzero_si256();
+    for (size_t k = 0; k < nchars_; ++k)
+      m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, c[k]));
+    out = flatten(out, i, static_cast<unsigned int>(_mm256_movemask_epi8(m)));
+  }
+#elif defined(__SSE2__)
+  __m128i c[max_chars];
+  for (size_t k = 0; k < nchars_; ++k)
+    c[k] = _mm_set1_epi8(chars_[k]);
+
+  for (; i + 16 <= n; i += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    __m128i m = _mm_setzero_si128();
+    for (size_t k = 0; k < nchars_; ++k)
+      m = _mm_or_si128(m, _mm_cmpeq_epi8(v, c[k]));
+    out = flatten(out, i, static_cast<unsigned int>(_mm_movemask_epi8(m)));
+  }
+#endif
+
+  // Scalar tail (or the whole buffer without SIMD support).
+  bool table[256];
+  std::memset(table, 0, sizeof(table));
+  for (size_t k = 0; k < nchars_; ++k)
+    table[static_cast<unsigned char>(chars_[k])] = true;
+
+  for (; i < n; ++i) {
+    if (table[static_cast<unsigned char>(b[i])])
+      *out++ = i;
+  }
+
+  count_ = out - offsets_.data();
+}
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <stdexcept>
+#include "contourpp_merge.hpp"
+#include "contourpp_sort.hpp"
+
+using namespace contourpp;
+
+namespace
+{
+
+struct entry_key
+{
+  boost::uint64_t operator()(const record_sorter::entry& x) const {
+    return sort_key(x.rec.minutes(), static_cast<boost::uint32_t>(x.rec.index()));
+  }
+};
+
+std::FILE* new_file()
+{
+  std::FILE* f = std::tmpfile();
+  if (!f)
+    throw std::runtime_error("Can't create a temporary file to sort");
+  return f;
+}
+
+void write_entries(std::FILE* f, const std::vector<record_sorter::entry>& entries)
+{
+  if (std::fwrite(entries.data(), sizeof(entries[0]), entries.size(), f) != entries.size())
+    throw std::runtime_error("Can't write a temporary file to sort");
+}
+
+// The entries of a sorted run, from a temporary file or from memory, read a
+// batch at a time.
+class run_source : public record_source
+{
+private:
+  std::FILE* file_;
+  std::fpos_t pos_;
+  size_t left_, batch_size_;
+  const record_sorter::entry *b_, *e_; // if file_ is NULL
+  const std::vector<meter_info>* meters_;
+  std::vector<record_sorter::entry> buf_;
+  boost::uint32_t meter_;
+
+protected:
+  bool fill() {
+    const record_sorter::entry *b, *e;
+    if (file_) {
+      // The file is shared with the other runs.
+      const size_t n = std::min(batch_size_, left_);
+      buf_.resize(n);
+      if ((n != 0) && ((std::fsetpos(file_, &pos_) != 0) ||
+          (std::fread(&buf_[0], sizeof(buf_[0]), n, file_) != n) ||
+          (std::fgetpos(file_, &pos_) != 0)))
+        throw std::runtime_error("Can't read back a temporary file of the sort");
+      left_ -= n;
+      b = buf_.data();
+      e = b + n;
+    }
+    else {
+      b = b_;
+      e = b_ = b_ + std::min<size_t>(batch_size_, e_ - b_);
+    }
+
+    if (b == e)
+      return false;
+    for (; b != e; ++b) {
+      if (b->meter != meter_)
+        header((*meters_)[meter_ = b->meter]);
+      visit(&b->rec, &b->rec + 1);
+    }
+    return true;
+  }
+
+public:
+  run_source(std::FILE* file, const record_sorter::run& run, size_t batch_size,
+    const std::vector<meter_info>& meters)
+    : file_(file), pos_(run.start), left_(run.size), batch_size_(batch_size), b_(NULL), e_(NULL),
+      meters_(&meters), meter_(0) {}
+
+  run_source(const record_sorter::entry* b, const record_sorter::entry* e, size_t batch_size,
+    const std::vector<meter_info>& meters)
+    : file_(NULL), left_(0), batch_size_(batch_size), b_(b), e_(e), meters_(&meters),
+      meter_(0) {}
+};
+
+// Writes the records of a merge to a temporary file as a run.
+class run_writer : public record_visitor
+{
+private:
+  std::FILE* file_;
+  size_t batch_size_, size_;
+  const std::vector<meter_info>& meters_;
+  std::vector<record_sorter::entry> buf_;
+  boost::uint32_t meter_;
+
+public:
+  run_writer(std::FILE* file, size_t batch_size, const std::vector<meter_info>& meters)
+    : file_(file), batch_size_(batch_size), size_(0), meters_(meters), meter_(0) {}
+
+  void header(const meter_info& info) {
+    meter_ = static_cast<boost::uint32_t>(std::find(meters_.begin(), meters_.end(), info) -
+      meters_.begin());
+  }
+
+  void visit(const record* b, const record* e) {
+    for (; b != e; ++b) {
+      buf_.push_back(record_sorter::entry());
+      buf_.back().rec = *b;
+      buf_.back().meter = meter_;
+      if (buf_.size() == batch_size_)
+        flush();
+    }
+  }
+
+  void flush() {
+    write_entries(file_, buf_);
+    size_ += buf_.size();
+    buf_.clear();
+  }
+
+  size_t size() const { return size_; }
+};
+
+} // namespace
+
+record_sorter::record_sorter(size_t memory, size_t jobs)
+  // Half of the memory is for the entries, half for sorting them. A merge
+  // reads a batch of each run (into an entry, then a record) and writes one.
+  : capacity_(std::max<size_t>(1, memory / (2 * sizeof(entry)))),
+    batch_size_(std::max<size_t>(64, std::min<size_t>(4096,
+      memory / ((max_fan_in + 1) * (sizeof(entry) + sizeof(record)))))),
+    jobs_(jobs), file_(NULL), meters_(1), meter_(0)
+{
+}
+
+record_sorter::~record_sorter()
+{
+  if (file_)
+    std::fclose(file_);
+}
+
+void record_sorter::header(const meter_info& info)
+{
+  if (meters_[meter_] == info)
+    return;
+
+  meter_ = static_cast<boost::uint32_t>(std::find(meters_.begin(), meters_.end(), info) -
+    meters_.begin());
+  if (meter_ == meters_.size())
+    meters_.push_back(info);
+}
+
+void record_sorter::visit(const record* b, const record* e)
+{
+  for (; b != e; ++b) {
+    if (run_.size() == capacity_) {
+      sort_run();
+      save_run();
+    }
+    if (run_.capacity() == run_.size())
+      run_.reserve(std::min(capacity_, std::max<size_t>(1024, 2 * run_.size())));
+    run_.push_back(entry());
+    run_.back().rec = *b;
+    run_.back().meter = meter_;
+  }
+}
+
+void record_sorter::sort_run()
+{
+  tmp_.resize(run_.size());
+  radix_sort(run_.data(), run_.data() + run_.size(), tmp_.data(), entry_key(), jobs_);
+}
+
+void record_sorter::save_run()
+{
+  if (!file_)
+    file_ = new_file();
+
+  run r;
+  r.size = run_.size();
+  if (std::fgetpos(file_, &r.start) != 0)
+    throw std::runtime_error("Can't write a temporary file to sort");
+  write_entries(file_, run_);
+  runs_.push_back(r);
+  run_.clear();
+}
+
+void record_sorter::merge_runs(size_t b, size_t e, record_visitor& visitor)
+{
+  std::vector<run_source> sources;
+  sources.reserve(e - b);
+  for (size_t i = b; i < e; ++i)
+    sources.push_back(run_source(file_, runs_[i], batch_size_, meters_));
+
+  std::vector<record_source*> inputs;
+  for (size_t i = 0; i < sources.size(); ++i)
+    inputs.push_back(&sources[i]);
+  merge_records(inputs, visitor, true);
+}
+
+void record_sorter::merge_pass()
+{
+  std::FILE* out = new_file();
+  std::vector<run> merged;
+
+  try {
+    for (size_t i = 0; i < runs_.size(); i += max_fan_in) {
+      run r;
+      if (std::fgetpos(out, &r.start) != 0)
+        throw std::runtime_error("Can't write a temporary file to sort");
+      run_writer writer(out, batch_size_, meters_);
+      merge_runs(i, std::min(i + max_fan_in, runs_.size()), writer);
+      writer.flush();
+      r.size = writer.size();
+      merged.push_back(r);
+    }
+  } catch (...) {
+    std::fclose(out);
+    throw;
+  }
+
+  std::fclose(file_);
+  file_ = out;
+  runs_.swap(merged);
+}
+
+void record_sorter::replay(record_visitor& visitor)
+{
+  sort_run();
+  std::vector<entry>().swap(tmp_);
+
+  if (runs_.empty()) {
+    run_source source(run_.data(), run_.data() + run_.size(), batch_size_, meters_);
+    std::vector<record_source*> inputs(1, &source);
+    merge_records(inputs, visitor, true);
+  }
+  else {
+    // Spill the last run too, to free the memory for the merges.
+    if (!run_.empty())
+      save_run();
+    std::vector<entry>().swap(run_);
+
+    while (runs_.size() > max_fan_in)
+      merge_pass();
+    merge_runs(0, runs_.size(), visitor);
+
+    std::fclose(file_);
+    file_ = NULL;
+  }
+
+  runs_.clear();
+  run_.clear();
+}
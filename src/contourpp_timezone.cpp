@@ -0,0 +1,362 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include "contourpp_driver.hpp"
+#include "contourpp_timezone.hpp"
+
+using namespace contourpp;
+
+static minutes_t clamp_minutes(long long m)
+{
+  return static_cast<minutes_t>(std::max<long long>(std::numeric_limits<minutes_t>::min(),
+    std::min<long long>(m, std::numeric_limits<minutes_t>::max())));
+}
+
+// Big endian signed integer of n (4 or 8) bytes.
+static long long get_be(const unsigned char* p, size_t n)
+{
+  unsigned long long v = 0;
+  for (size_t i = 0; i < n; ++i)
+    v = (v << 8) | p[i];
+  if (n < 8 && (v & (1ULL << (8 * n - 1))))
+    v |= ~0ULL << (8 * n);
+  return static_cast<long long>(v);
+}
+
+namespace
+{
+
+// A rule of a POSIX TZ string (as in the footer of TZif files): a day of the
+// year, and the local time of day of the transition, in seconds.
+struct posix_rule
+{
+  char kind; // 'M' (month, week, weekday), 'J' (day 1..365, no Feb 29) or 'n' (day 0..365)
+  long month, week, day;
+  long time;
+
+  posix_rule() : kind('n'), month(0), week(0), day(0), time(2 * 3600) {}
+
+  // Days since 1970-01-01 of the day of the rule in year y.
+  long days(long y) const {
+    switch (kind) {
+      case 'J':
+        return days_from_civil(y, 1, 1) + day - 1 + ((day >= 60) && is_leap_year(y));
+      case 'M': {
+        const long first = days_from_civil(y, static_cast<unsigned>(month), 1);
+        const long weekday = first + 4 - floor_div(first + 4, 7) * 7;
+        long d = first + (day - weekday + 7) % 7 + (week - 1) * 7;
+        if (d - first >= static_cast<long>(last_day_of_month(y, static_cast<unsigned>(month))))
+          d -= 7; // week 5 is the last one
+        return d;
+      }
+      default:
+        return days_from_civil(y, 1, 1) + day;
+    }
+  }
+};
+
+// Parser of POSIX TZ strings, e.g. "EET-2EEST,M3.5.0/3,M10.5.0/4".
+class posix_tz_parser
+{
+private:
+  const std::string& s_;
+  size_t p_;
+
+  void fail() const {
+    throw std::runtime_error("Invalid time zone rule: " + s_);
+  }
+
+  long number() {
+    if ((p_ >= s_.size()) || !std::isdigit(static_cast<unsigned char>(s_[p_])))
+      fail();
+    long n = 0;
+    while ((p_ < s_.size()) && std::isdigit(static_cast<unsigned char>(s_[p_])))
+      n = n * 10 + (s_[p_++] - '0');
+    return n;
+  }
+
+public:
+  explicit posix_tz_parser(const std::string& s) : s_(s), p_(0) {}
+
+  bool done() const { return p_ >= s_.size(); }
+  bool accept(char c) {
+    if ((p_ < s_.size()) && (s_[p_] == c)) {
+      ++p_;
+      return true;
+    }
+    return false;
+  }
+
+  // Zone abbreviation, e.g. EET or <+03>; false if there is none.
+  bool name() {
+    const size_t b = p_;
+    if (accept('<')) {
+      while ((p_ < s_.size()) && (s_[p_] != '>'))
+        ++p_;
+      if (!accept('>'))
+        fail();
+    }
+    else
+      while ((p_ < s_.size()) && std::isalpha(static_cast<unsigned char>(s_[p_])))
+        ++p_;
+    return p_ > b;
+  }
+
+  // [+-]hh[:mm[:ss]], in seconds.
+  long seconds() {
+    const bool negative = accept('-');
+    if (!negative)
+      accept('+');
+    long s = number() * 3600;
+    if (accept(':')) {
+      s += number() * 60;
+      if (accept(':'))
+        s += number();
+    }
+    return negative? -s : s;
+  }
+
+  bool at_offset() const {
+    return !done() && (std::isdigit(static_cast<unsigned char>(s_[p_])) ||
+      (s_[p_] == '+') || (s_[p_] == '-'));
+  }
+
+  posix_rule rule() {
+    posix_rule r;
+    if (accept('M')) {
+      r.kind = 'M';
+      r.month = number();
+      if (!accept('.')) fail();
+      r.week = number();
+      if (!accept('.')) fail();
+      r.day = number();
+      if ((r.month < 1) || (r.month > 12) || (r.week < 1) || (r.week > 5) || (r.day > 6))
+        fail();
+    }
+    else {
+      if (accept('J'))
+        r.kind = 'J';
+      r.day = number();
+    }
+    if (accept('/'))
+      r.time = seconds();
+    return r;
+  }
+};
+
+} // namespace
+
+time_zone::time_zone()
+  : name_("UTC")
+{
+  add(std::numeric_limits<minutes_t>::min(), 0);
+}
+
+time_zone::time_zone(const std::string& name)
+  : name_(name)
+{
+  if (name.empty() || (name.find("..") != std::string::npos))
+    throw std::runtime_error("Can't read time zone: " + name);
+
+  const char* dir = std::getenv("TZDIR");
+  const std::string path = ((name[0] == '/')? "" :
+    std::string((dir && dir[0])? dir : "/usr/share/zoneinfo") + "/") + name;
+
+  std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+  const std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)),
+    std::istreambuf_iterator<char>());
+  if (!file || (data.size() < 44) || std::memcmp(&data[0], "TZif", 4))
+    throw std::runtime_error("Can't read time zone: " + name);
+
+  // Version 1 data has 32-bit times; version 2 and later repeat it with
+  // 64-bit times, followed by a POSIX TZ string for the times after the last
+  // transition.
+  const unsigned char version = data[4];
+  size_t p = 0, time_size = 4;
+  size_t isutcnt, isstdcnt, leapcnt, timecnt, typecnt, charcnt;
+  for (;;) {
+    if (data.size() < p + 44)
+      throw std::runtime_error("Can't read time zone: " + name);
+    const unsigned char* h = &data[p + 20];
+    isutcnt = static_cast<size_t>(get_be(h, 4));
+    isstdcnt = static_cast<size_t>(get_be(h + 4, 4));
+    leapcnt = static_cast<size_t>(get_be(h + 8, 4));
+    timecnt = static_cast<size_t>(get_be(h + 12, 4));
+    typecnt = static_cast<size_t>(get_be(h + 16, 4));
+    charcnt = static_cast<size_t>(get_be(h + 20, 4));
+    p += 44;
+    if ((version < '2') || (time_size == 8))
+      break;
+    p += timecnt * 5 + typecnt * 6 + charcnt + leapcnt * 8 + isstdcnt + isutcnt;
+    time_size = 8;
+  }
+
+  const size_t types = p + timecnt * (time_size + 1);
+  const size_t end = types + typecnt * 6 + charcnt + leapcnt * (time_size + 4) + isstdcnt + isutcnt;
+  if ((typecnt == 0) || (data.size() < end))
+    throw std::runtime_error("Can't read time zone: " + name);
+
+  // Offsets of the local time types, rounded down to minutes.
+  std::vector<minutes_t> type_offsets(typecnt);
+  for (size_t i = 0; i < typecnt; ++i)
+    type_offsets[i] = static_cast<minutes_t>(
+      floor_div(static_cast<long>(get_be(&data[types + i * 6], 4)), 60));
+
+  // Times before the first transition are of type 0.
+  add(std::numeric_limits<minutes_t>::min(), type_offsets[0]);
+  minutes_t last = std::numeric_limits<minutes_t>::min();
+  for (size_t i = 0; i < timecnt; ++i) {
+    const size_t type = data[p + timecnt * time_size + i];
+    if (type >= typecnt)
+      throw std::runtime_error("Can't read time zone: " + name);
+    const long long t = get_be(&data[p + i * time_size], time_size);
+    last = clamp_minutes(floor_div(static_cast<long>(t), 60));
+    add(last, type_offsets[type]);
+  }
+
+  if ((version >= '2') && (data.size() > end + 1) && (data[end] == '\n')) {
+    const std::vector<unsigned char>::const_iterator b = data.begin() + end + 1;
+    const std::string tz(b, std::find(b, data.end(), '\n'));
+    if (!tz.empty())
+      add_rules(tz, last);
+  }
+}
+
+void time_zone::add(minutes_t start, minutes_t offset)
+{
+  if (!starts_.empty() && (start <= starts_.back())) {
+    if (start < starts_.back())
+      return;
+    starts_.pop_back();
+    offsets_.pop_back();
+  }
+  if (!offsets_.empty() && (offsets_.back() == offset))
+    return;
+
+  starts_.push_back(start);
+  offsets_.push_back(offset);
+}
+
+// Add the transitions after the time after by the rules of a POSIX TZ string,
+// up to last_year.
+void time_zone::add_rules(const std::string& tz, minutes_t after)
+{
+  posix_tz_parser parser(tz);
+  if (!parser.name() || !parser.at_offset())
+    throw std::runtime_error("Invalid time zone rule: " + tz);
+
+  // POSIX offsets are west of UTC.
+  const long std_offset = -parser.seconds();
+  if (parser.done() || !parser.name()) {
+    if (!parser.done())
+      throw std::runtime_error("Invalid time zone rule: " + tz);
+    add(after, static_cast<minutes_t>(floor_div(std_offset, 60)));
+    return;
+  }
+
+  const long dst_offset = parser.at_offset()? -parser.seconds() : std_offset + 3600;
+  if (!parser.accept(','))
+    throw std::runtime_error("Invalid time zone rule: " + tz);
+  const posix_rule start = parser.rule();
+  if (!parser.accept(','))
+    throw std::runtime_error("Invalid time zone rule: " + tz);
+  const posix_rule end = parser.rule();
+  if (!parser.done())
+    throw std::runtime_error("Invalid time zone rule: " + tz);
+
+  long first_year = 1970;
+  if (after != std::numeric_limits<minutes_t>::min()) {
+    unsigned m, d;
+    civil_from_days(floor_div(after, minutes_per_day), first_year, m, d);
+  }
+
+  for (long y = first_year; y <= last_year; ++y) {
+    // Daylight time starts at a standard time, and ends at a daylight time.
+    const long long dst_begin = (start.days(y) * 86400LL + start.time - std_offset) / 60;
+    const long long dst_end = (end.days(y) * 86400LL + end.time - dst_offset) / 60;
+    const minutes_t std_minutes = static_cast<minutes_t>(floor_div(std_offset, 60));
+    const minutes_t dst_minutes = static_cast<minutes_t>(floor_div(dst_offset, 60));
+
+    if (dst_begin < dst_end) {
+      if (dst_begin > after) add(clamp_minutes(dst_begin), dst_minutes);
+      if (dst_end > after) add(clamp_minutes(dst_end), std_minutes);
+    }
+    else { // southern hemisphere
+      if (dst_end > after) add(clamp_minutes(dst_end), std_minutes);
+      if (dst_begin > after) add(clamp_minutes(dst_begin), dst_minutes);
+    }
+  }
+}
+
+minutes_t time_zone::offset(minutes_t utc) const
+{
+  return offsets_[std::upper_bound(starts_.begin(), starts_.end(), utc) - starts_.begin() - 1];
+}
+
+minutes_t time_zone::min_offset() const
+{
+  return *std::min_element(offsets_.begin(), offsets_.end());
+}
+
+minutes_t time_zone::max_offset() const
+{
+  return *std::max_element(offsets_.begin(), offsets_.end());
+}
+
+time_zone::cursor::cursor(const time_zone& zone)
+  : zone_(zone), i_(0), begin_(0), end_(0), offset_(0)
+{
+}
+
+void time_zone::cursor::seek(minutes_t utc)
+{
+  const std::vector<minutes_t>& starts = zone_.starts_;
+  const size_t n = starts.size();
+
+  // Times in order usually move on to the next interval.
+  size_t i = i_ + 1;
+  if ((i >= n) || (utc < starts[i]) || ((i + 1 < n) && (utc >= starts[i + 1])))
+    i = std::upper_bound(starts.begin(), starts.end(), utc) - starts.begin() - 1;
+
+  i_ = i;
+  begin_ = starts[i];
+  end_ = (i + 1 < n)? starts[i + 1] : std::numeric_limits<minutes_t>::max();
+  offset_ = zone_.offsets_[i];
+}
+
+minutes_t time_zone::cursor::to_utc(minutes_t local)
+{
+  // The offset of a day before is the one before any transition near local.
+  const minutes_t early = offset(clamp_minutes(static_cast<long long>(local) - minutes_per_day));
+  const minutes_t utc = clamp_minutes(static_cast<long long>(local) - early);
+  const minutes_t late = offset(utc);
+  if (late == early)
+    return utc;
+
+  // local is after the transition if it is so with the offset after it.
+  const minutes_t later = clamp_minutes(static_cast<long long>(local) - late);
+  return (offset(later) == late)? later : utc;
+}
+
+zone_converter::zone_converter(const time_zone& from, const time_zone& to)
+  : from_(from), to_(to), from_cursor_(from_), to_cursor_(to_)
+{
+}
+
+void zone_converter::convert(minutes_t* b, minutes_t* e)
+{
+  for (; b != e; ++b)
+    if (*b != record::no_minutes)
+      *b = convert(*b);
+}
+
+minutes_t zone_converter::max_shift() const
+{
+  return std::max(std::abs(to_.max_offset() - from_.min_offset()),
+    std::abs(to_.min_offset() - from_.max_offset()));
+}